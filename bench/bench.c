@@ -0,0 +1,317 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bit-expand.h"
+#include "render.h"
+#include "xbm.h"
+
+// Keep repeating a measurement until this much time has been spent
+#define MIN_BENCH_SECONDS 0.5
+#define MIN_ITERATIONS 3
+
+struct timing {
+    double best;
+    double mean;
+    unsigned int iterations;
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Time fn until MIN_BENCH_SECONDS have passed; fn returns false on failure
+static bool measure(bool (*fn)(void *), void *data, struct timing *t) {
+    double total = 0;
+    t->best = 0;
+    t->iterations = 0;
+    
+    while (total < MIN_BENCH_SECONDS || t->iterations < MIN_ITERATIONS) {
+        double start = now();
+        if (!fn(data)) {
+            return false;
+        }
+        double elapsed = now() - start;
+        
+        if (t->iterations == 0 || elapsed < t->best) {
+            t->best = elapsed;
+        }
+        total += elapsed;
+        t->iterations++;
+    }
+    
+    t->mean = total / t->iterations;
+    return true;
+}
+
+// Render and recolor benchmarks
+
+struct render_bench {
+    struct render_params params;
+    struct render_mask *mask;  // recolor from this instead of rendering
+    void *pixels;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+};
+
+static bool run_render(void *data) {
+    struct render_bench *b = data;
+    return render_pattern(&b->params, b->pixels, b->width, b->height, b->stride);
+}
+
+// A color change with a kept mask, as the daemon and -cycle do it
+static bool run_recolor(void *data) {
+    struct render_bench *b = data;
+    struct render_plan *plan = render_plan_create(&b->params, b->width, b->height);
+    bool ok = plan && render_plan_recolor(plan, b->mask, b->pixels, b->stride, 0, b->height);
+    render_plan_destroy(plan);
+    return ok;
+}
+
+static struct xbm_image *make_pattern(const char *name, const char *xbm_file) {
+    if (strcmp(name, "solid") == 0) {
+        return NULL;
+    }
+    if (strcmp(name, "gray") == 0) {
+        static const unsigned char gray_bits[] = { 0x01, 0x02 };
+        return xbm_create(2, 2, gray_bits);
+    }
+    if (strcmp(name, "mod") == 0) {
+        // Same tile as -mod 4 4
+        unsigned char bits[32] = {0};
+        for (unsigned int y = 0; y < 16; y++) {
+            for (unsigned int x = 0; x < 16; x++) {
+                if (y % 4 == 0 || x % 4 == 0) {
+                    bits[y * 2 + x / 8] |= 1 << (x % 8);
+                }
+            }
+        }
+        return xbm_create(16, 16, bits);
+    }
+    if (strcmp(name, "xbm") == 0 && xbm_file) {
+        return xbm_load(xbm_file);
+    }
+    
+    fprintf(stderr, "Unknown pattern: %s\n", name);
+    return NULL;
+}
+
+static int bench_render(int argc, char *argv[]) {
+    if (argc < 4) {
+        fprintf(stderr, "Usage: render|recolor <solid|gray|mod|xbm> <w>x<h> <scale> "
+                "[xrgb8888|rgb565] [file.xbm] [nearest|box]\n");
+        return 1;
+    }
+    
+    struct render_bench b = {0};
+    if (sscanf(argv[2], "%ux%u", &b.width, &b.height) != 2 ||
+        b.width == 0 || b.height == 0) {
+        fprintf(stderr, "Invalid size: %s\n", argv[2]);
+        return 1;
+    }
+    
+    b.params.format = PIXEL_FORMAT_XRGB8888;
+    if (argc > 4 && strcmp(argv[4], "rgb565") == 0) {
+        b.params.format = PIXEL_FORMAT_RGB565;
+    } else if (argc > 4 && strcmp(argv[4], "xrgb8888") != 0) {
+        fprintf(stderr, "Unknown format: %s\n", argv[4]);
+        return 1;
+    }
+    
+    b.params.filter = RENDER_FILTER_NEAREST;
+    if (argc > 6 && strcmp(argv[6], "box") == 0) {
+        b.params.filter = RENDER_FILTER_BOX;
+    } else if (argc > 6 && strcmp(argv[6], "nearest") != 0) {
+        fprintf(stderr, "Unknown filter: %s\n", argv[6]);
+        return 1;
+    }
+    
+    struct xbm_image *image = make_pattern(argv[1], argc > 5 ? argv[5] : NULL);
+    if (!image && strcmp(argv[1], "solid") != 0) {
+        return 1;
+    }
+    
+    b.params.image = image;
+    b.params.scale = strtof(argv[3], NULL);
+    b.params.fg = 0xFFE94560;
+    b.params.bg = 0xFF1A1A2E;
+    b.stride = b.width * pixel_format_bytes(b.params.format);
+    b.pixels = malloc((size_t)b.stride * b.height);
+    if (!b.pixels || b.params.scale <= 0) {
+        fprintf(stderr, "Invalid scale or out of memory\n");
+        free(b.pixels);
+        xbm_free(image);
+        return 1;
+    }
+    
+    bool (*run)(void *) = run_render;
+    if (strcmp(argv[0], "recolor") == 0) {
+        b.mask = render_mask_create(&b.params, b.width, b.height);
+        if (!b.mask) {
+            fprintf(stderr, "No mask: the pattern is filtered at this scale\n");
+            free(b.pixels);
+            xbm_free(image);
+            return 1;
+        }
+        run = run_recolor;
+    }
+    
+    // Warm up: fault in the buffer so the timings measure rendering only
+    struct timing t;
+    bool ok = run(&b) && measure(run, &b, &t);
+    if (ok) {
+        double mpix = (double)b.width * b.height / 1e6;
+        double mb = (double)b.stride * b.height / 1e6;
+        printf("%-7s %-5s %ux%u scale %-4g %s%s [%s]: best %.3f ms, mean %.3f ms "
+               "(%u runs), %.1f MPix/s, %.1f MB/s\n",
+               argv[0], argv[1], b.width, b.height, b.params.scale,
+               b.params.format == PIXEL_FORMAT_RGB565 ? "rgb565" : "xrgb8888",
+               b.params.filter == RENDER_FILTER_BOX ? " box" : "",
+               bit_expand_kernel_name(), t.best * 1e3, t.mean * 1e3, t.iterations,
+               mpix / t.best, mb / t.best);
+    } else {
+        fprintf(stderr, "Render failed\n");
+    }
+    
+    render_mask_destroy(b.mask);
+    free(b.pixels);
+    xbm_free(image);
+    return ok ? 0 : 1;
+}
+
+// XBM parser and PBM loader benchmarks
+
+struct load_bench {
+    const char *path;
+    struct xbm_image *(*load)(const char *filename);
+};
+
+static bool run_load(void *data) {
+    struct load_bench *b = data;
+    struct xbm_image *image = b->load(b->path);
+    xbm_free(image);
+    return image != NULL;
+}
+
+// Write a width x height XBM with pseudo-random bits to a temporary file
+static bool write_test_xbm(char *path, unsigned int width, unsigned int height,
+                           long *file_size) {
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to create %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    
+    FILE *fp = fdopen(fd, "w");
+    if (!fp) {
+        close(fd);
+        unlink(path);
+        return false;
+    }
+    
+    fprintf(fp, "#define bench_width %u\n#define bench_height %u\n"
+            "static unsigned char bench_bits[] = {\n", width, height);
+    
+    size_t count = (size_t)((width + 7) / 8) * height;
+    uint32_t seed = 0x12345678;
+    for (size_t i = 0; i < count; i++) {
+        seed = seed * 1103515245 + 12345;
+        fprintf(fp, "0x%02x%s", (seed >> 16) & 0xFF,
+                i + 1 == count ? "};\n" : (i % 12 == 11 ? ",\n" : ", "));
+    }
+    
+    *file_size = ftell(fp);
+    if (fclose(fp) != 0) {
+        unlink(path);
+        return false;
+    }
+    return true;
+}
+
+// Write a width x height binary PBM with pseudo-random bits to a temporary file
+static bool write_test_pbm(char *path, unsigned int width, unsigned int height,
+                           long *file_size) {
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to create %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    
+    FILE *fp = fdopen(fd, "wb");
+    if (!fp) {
+        close(fd);
+        unlink(path);
+        return false;
+    }
+    
+    fprintf(fp, "P4\n%u %u\n", width, height);
+    size_t count = (size_t)((width + 7) / 8) * height;
+    uint32_t seed = 0x12345678;
+    for (size_t i = 0; i < count; i++) {
+        seed = seed * 1103515245 + 12345;
+        fputc((seed >> 16) & 0xFF, fp);
+    }
+    
+    *file_size = ftell(fp);
+    if (fclose(fp) != 0) {
+        unlink(path);
+        return false;
+    }
+    return true;
+}
+
+// argv[0] is "xbm" or "pbm"
+static int bench_load(int argc, char *argv[]) {
+    bool pbm = strcmp(argv[0], "pbm") == 0;
+    unsigned int width, height;
+    if (argc < 2 || sscanf(argv[1], "%ux%u", &width, &height) != 2 ||
+        width == 0 || height == 0) {
+        fprintf(stderr, "Usage: %s <w>x<h>\n", argv[0]);
+        return 1;
+    }
+    
+    char path[] = "/tmp/wlrsetroot-bench-XXXXXX";
+    long file_size;
+    if (!(pbm ? write_test_pbm : write_test_xbm)(path, width, height, &file_size)) {
+        return 1;
+    }
+    
+    struct load_bench b = { .path = path, .load = pbm ? pbm_load : xbm_load };
+    struct timing t;
+    bool ok = measure(run_load, &b, &t);
+    if (ok) {
+        double mpix = (double)width * height / 1e6;
+        printf("%s_load %ux%u (%.2f MB): best %.3f ms, mean %.3f ms (%u runs), "
+               "%.1f MB/s, %.1f MPix/s\n",
+               argv[0], width, height, file_size / 1e6, t.best * 1e3, t.mean * 1e3,
+               t.iterations, file_size / 1e6 / t.best, mpix / t.best);
+    } else {
+        fprintf(stderr, "%s_load failed\n", argv[0]);
+    }
+    
+    unlink(path);
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+    bit_expand_init();
+    
+    if (argc >= 2 && (strcmp(argv[1], "render") == 0 || strcmp(argv[1], "recolor") == 0)) {
+        return bench_render(argc - 1, argv + 1);
+    }
+    if (argc >= 2 && (strcmp(argv[1], "xbm") == 0 || strcmp(argv[1], "pbm") == 0)) {
+        return bench_load(argc - 1, argv + 1);
+    }
+    
+    fprintf(stderr, "Usage: %s render|recolor|xbm|pbm ...\n", argv[0]);
+    return 1;
+}
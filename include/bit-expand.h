@@ -0,0 +1,30 @@
+#ifndef BIT_EXPAND_H
+#define BIT_EXPAND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Select the fastest expansion kernel for this CPU
+// Call once at startup; until then the scalar kernel is used
+void bit_expand_init(void);
+
+// Name of the selected kernel ("scalar", "sse2", "avx2", "neon")
+const char *bit_expand_kernel_name(void);
+
+// Expand count bits (LSB first, starting at bit 0 of src) into ARGB words
+// 0 bits become zero_color, 1 bits become one_color
+void bit_expand(uint32_t *dst, const unsigned char *src, size_t count,
+                uint32_t zero_color, uint32_t one_color);
+
+// Same for 16-bit pixels such as RGB565
+void bit_expand16(uint16_t *dst, const unsigned char *src, size_t count,
+                  uint16_t zero_color, uint16_t one_color);
+
+// Same as bit_expand and bit_expand16 for bits stored MSB first, as in
+// PBM rows: pixel 0 is bit 7 of src[0]
+void bit_expand_msb(uint32_t *dst, const unsigned char *src, size_t count,
+                    uint32_t zero_color, uint32_t one_color);
+void bit_expand16_msb(uint16_t *dst, const unsigned char *src, size_t count,
+                      uint16_t zero_color, uint16_t one_color);
+
+#endif // BIT_EXPAND_H
@@ -0,0 +1,61 @@
+#ifndef BUFFER_CACHE_H
+#define BUFFER_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+#include "pool-buffer.h"
+#include "render.h"
+
+// Everything that determines a buffer's contents
+struct buffer_key {
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    struct render_params params;
+};
+
+// A rendered buffer shared by every output with the same key
+struct shared_buffer {
+    struct wl_list link;  // buffer_cache.buffers
+    struct buffer_key key;
+    struct buffer_pool pool;
+    struct pool_buffer *buffer;  // slot of pool holding the current contents
+    int refs;
+    bool rendered;  // contents are complete and may be attached
+    bool cache_store;  // contents are to be written to the on-disk cache
+    struct render_mask *mask;  // coverage kept for recoloring, NULL if none
+    
+    // In-flight render, owned by the worker pool until it is waited on
+    struct render_plan *plan;
+    struct render_band *bands;
+    uint32_t band_count;
+};
+
+struct buffer_cache {
+    struct wl_list buffers;  // list of shared_buffer
+};
+
+// Whether two keys describe identical buffer contents
+bool buffer_key_equal(const struct buffer_key *a, const struct buffer_key *b);
+
+// Initialize an empty cache
+void buffer_cache_init(struct buffer_cache *cache);
+
+// Find a buffer with a matching key and take a reference to it
+// Returns NULL if there is none
+struct shared_buffer *buffer_cache_find(struct buffer_cache *cache,
+                                        const struct buffer_key *key);
+
+// Add an empty entry for key holding one reference
+// The caller acquires entry->buffer from entry->pool and renders it.
+// Returns NULL on failure
+struct shared_buffer *buffer_cache_add(struct buffer_cache *cache,
+                                       const struct buffer_key *key,
+                                       struct shm_arena *arena);
+
+// Drop a reference; the buffer is destroyed with the last one
+void shared_buffer_unref(struct shared_buffer *buf);
+
+#endif // BUFFER_CACHE_H
@@ -0,0 +1,16 @@
+#ifndef BUILTIN_PATTERNS_H
+#define BUILTIN_PATTERNS_H
+
+// Bitmaps compiled in by tools/xbm2c, so -builtin needs no file access
+// Bits are in xbm_image layout: LSB first, byte-padded rows
+struct builtin_pattern {
+    const char *name;
+    unsigned int width;
+    unsigned int height;
+    const unsigned char *bits;
+};
+
+extern const struct builtin_pattern builtin_patterns[];
+extern const unsigned int builtin_pattern_count;
+
+#endif // BUILTIN_PATTERNS_H
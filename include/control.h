@@ -0,0 +1,44 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Largest command accepted on the control socket, in bytes
+#define CONTROL_MAX_MESSAGE 4096
+
+// Most arguments in one command
+#define CONTROL_MAX_ARGS 64
+
+// Room for a socket path, the size of sockaddr_un.sun_path
+#define CONTROL_PATH_MAX 108
+
+// A command is its arguments, each terminated by a NUL byte, sent on a
+// fresh connection that the client then shuts down for writing. The
+// daemon answers with one line, "ok <ms>" once the change is on screen
+// or "error <reason>", and closes the connection.
+
+// Build the control socket path, $XDG_RUNTIME_DIR/wlrsetroot.sock
+// Returns false if XDG_RUNTIME_DIR is unset or the path does not fit
+bool control_socket_path(char *path, size_t size);
+
+// Listen on the control socket, replacing a stale socket file left by a
+// daemon that did not exit cleanly. Returns the listening fd or -1
+int control_listen(const char *path);
+
+// Accept a client and read its command into buf
+// argv receives pointers into buf. Returns the client fd, or -1 if the
+// connection failed or the command was malformed
+int control_accept(int listen_fd, char *buf, size_t size,
+                   char *argv[], int max_args, int *argc);
+
+// Send a reply line to a client and close its connection
+void control_reply(int fd, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// Client side: send a command and wait for the reply line
+// Returns false if the daemon could not be reached
+bool control_send(const char *path, int argc, char *argv[],
+                  char *reply, size_t size);
+
+#endif // CONTROL_H
@@ -0,0 +1,25 @@
+#ifndef IMAGE_FILE_H
+#define IMAGE_FILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "render.h"
+
+enum image_file_format {
+    IMAGE_FILE_PPM,  // binary PPM (P6), RGB
+    IMAGE_FILE_PAM,  // PAM (P7), RGB_ALPHA
+    IMAGE_FILE_FARBFELD,  // farbfeld, 16-bit RGBA
+};
+
+// Pick the format from a file name extension; defaults to PPM
+enum image_file_format image_file_format_from_name(const char *path);
+
+// Render the pattern into an image file without a compositor
+// Rows are rendered and written a few at a time, so memory use does not
+// grow with the image height. path "-" writes to stdout
+bool image_file_render(const char *path, enum image_file_format format,
+                       const struct render_params *params,
+                       uint32_t width, uint32_t height);
+
+#endif // IMAGE_FILE_H
@@ -2,22 +2,132 @@
 #define POOL_BUFFER_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <sys/types.h>
 #include <wayland-client.h>
 
+// One sealed memfd shared with the compositor as a single wl_shm_pool
+// Buffers are sub-allocated from it and their ranges reused once freed
+struct shm_arena;
+
+// Number of buffers a buffer pool cycles through
+#define BUFFER_POOL_SLOTS 3
+
 struct pool_buffer {
     struct wl_buffer *buffer;
     void *data;
     uint32_t width;
     uint32_t height;
+    uint32_t stride;  // bytes per row
+    uint32_t format;
     size_t size;
+    bool busy;  // attached and not yet released by the compositor
+    bool faulted;  // pages are mapped in, see shm_arena_unmap()
+    
+    struct shm_arena *arena;  // NULL for buffers not backed by shm
+    size_t offset;  // byte offset into the arena
+    struct wl_list link;  // shm_arena.buffers
+    struct wl_list views;  // pool_buffer_view.link
+};
+
+// A wl_buffer showing a rectangle of a pool buffer
+// It shares the buffer's memory and stride, so nothing is copied. The
+// buffer counts as busy while any of its views is
+struct pool_buffer_view {
+    struct wl_buffer *buffer;
+    struct pool_buffer *parent;  // NULL once the viewed buffer is destroyed
+    bool busy;
+    struct wl_list link;  // pool_buffer.views
+};
+
+// Buffers drawn in turn for the same contents
+// A redraw goes into a slot the compositor has released, so memory it may
+// still be reading is never written. Slots are allocated on first use and
+// kept, so alternating between same-sized frames never touches the arena
+struct buffer_pool {
+    struct shm_arena *arena;
+    struct pool_buffer slots[BUFFER_POOL_SLOTS];
 };
 
+enum shm_arena_flags {
+    // Back the arena with explicit huge pages, falling back to regular
+    // shmem (with transparent huge pages where enabled) if none are free
+    SHM_ARENA_HUGETLB = 1 << 0,
+};
+
+// Create an empty arena; memory is allocated on first use
+struct shm_arena *shm_arena_create(struct wl_shm *shm, uint32_t flags);
+
+// Destroy an arena. All of its buffers must have been destroyed
+void shm_arena_destroy(struct shm_arena *arena);
+
+// Bytes currently handed out to buffers
+size_t shm_arena_allocated(const struct shm_arena *arena);
+
+// Total size of the shared memory pool
+size_t shm_arena_size(const struct shm_arena *arena);
+
+// Drop our mapping of the arena; the memfd, pool and wl_buffers stay alive,
+// so the compositor keeps showing them. Buffers' data is NULL until the
+// arena is mapped again, and nothing may be rendering into it. Returns
+// false if it was not mapped
+bool shm_arena_unmap(struct shm_arena *arena);
+
+// Map the arena again after shm_arena_unmap(); does nothing if it is mapped
+// Buffers are faulted in again when next acquired. Returns false on failure
+bool shm_arena_map(struct shm_arena *arena);
+
 // Create a shared memory buffer
-bool pool_buffer_create(struct pool_buffer *buf, struct wl_shm *shm,
+bool pool_buffer_create(struct pool_buffer *buf, struct shm_arena *arena,
                         uint32_t width, uint32_t height, uint32_t format);
 
+// Give the buffer new dimensions within its existing memory and stride
+// A new wl_buffer is created; the caller owns the previous one and should
+// destroy it once the new one is committed. Returns false if it won't fit
+bool pool_buffer_reshape(struct pool_buffer *buf, uint32_t width, uint32_t height,
+                         uint32_t format);
+
+// Fill the buffer's rows from a file, starting at offset
+// Copied inside the kernel into the arena's file where the filesystems
+// allow it, otherwise read into the mapping. Returns false if the file is
+// short or unreadable
+bool pool_buffer_read(struct pool_buffer *buf, int fd, off_t offset);
+
+// Attach the buffer to a surface and mark it busy until it is released
+void pool_buffer_attach(struct pool_buffer *buf, struct wl_surface *surface);
+
+// Whether the compositor may still read the buffer or one of its views
+bool pool_buffer_busy(const struct pool_buffer *buf);
+
+// Create a view of the width x height rectangle at (x, y) of a shm buffer
+// Returns false if the rectangle doesn't fit or on failure
+bool pool_buffer_view_create(struct pool_buffer_view *view, struct pool_buffer *buf,
+                             uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+
+// Attach a view to a surface and mark it busy until it is released
+void pool_buffer_view_attach(struct pool_buffer_view *view, struct wl_surface *surface);
+
+// Destroy a view; does nothing for one never created
+void pool_buffer_view_destroy(struct pool_buffer_view *view);
+
 // Destroy a pool buffer
 void pool_buffer_destroy(struct pool_buffer *buf);
 
+// Initialize a pool with empty slots
+void buffer_pool_init(struct buffer_pool *pool, struct shm_arena *arena);
+
+// Get a slot the compositor isn't using, sized width x height
+// A free slot of that size is returned as is; otherwise a free slot is
+// reshaped within its memory or reallocated. Returns NULL if every slot is
+// busy or allocation fails
+struct pool_buffer *buffer_pool_acquire(struct buffer_pool *pool, uint32_t width,
+                                        uint32_t height, uint32_t format);
+
+// Number of slots the compositor still holds
+uint32_t buffer_pool_busy_count(const struct buffer_pool *pool);
+
+// Destroy every slot of a pool
+void buffer_pool_finish(struct buffer_pool *pool);
+
 #endif // POOL_BUFFER_H
@@ -0,0 +1,42 @@
+#ifndef RENDER_CACHE_H
+#define RENDER_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "buffer-cache.h"
+
+// Rendered buffers kept on disk between runs, in $XDG_CACHE_HOME/wlrsetroot
+// Each file holds a header describing its key and the tile's bits, followed
+// by the raw rows
+struct render_cache;
+
+// Default size limit of the cache directory
+#define RENDER_CACHE_DEFAULT_SIZE (256u << 20)
+
+// Buffers smaller than this render faster than they load and are skipped
+#define RENDER_CACHE_MIN_SIZE (256u << 10)
+
+// Offset of the pixel rows in a cache file
+#define RENDER_CACHE_DATA_OFFSET 4096
+
+// Open the cache directory, creating it if needed
+// Returns NULL if there is no usable cache directory
+struct render_cache *render_cache_open(size_t max_size);
+
+// Close a cache
+void render_cache_close(struct render_cache *cache);
+
+// Find the rows of a buffer with the given key and stride
+// The file is marked as recently used. Returns an fd to read the rows from
+// at RENDER_CACHE_DATA_OFFSET, or -1 if there is none
+int render_cache_lookup(struct render_cache *cache, const struct buffer_key *key,
+                        uint32_t stride);
+
+// Store the rows of a rendered buffer, then evict the least recently used
+// files until the cache fits its size limit
+bool render_cache_store(struct render_cache *cache, const struct buffer_key *key,
+                        uint32_t stride, const void *data);
+
+#endif // RENDER_CACHE_H
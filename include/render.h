@@ -0,0 +1,113 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "xbm.h"
+
+enum pixel_format {
+    PIXEL_FORMAT_ARGB8888,
+    PIXEL_FORMAT_XRGB8888,
+    PIXEL_FORMAT_RGB565,
+};
+
+enum render_filter {
+    RENDER_FILTER_NEAREST,  // every device pixel takes one pattern bit
+    RENDER_FILTER_BOX,  // device pixels blend fg and bg by pattern coverage
+};
+
+struct render_params {
+    const struct xbm_image *image;  // NULL for a solid fill
+    float scale;  // Pattern scale factor
+    uint32_t fg;  // Color for 0 bits (ARGB)
+    uint32_t bg;  // Color for 1 bits and solid fills (ARGB)
+    enum pixel_format format;  // Layout of the rendered pixels
+    enum render_filter filter;  // Sampling at scales other than 1
+};
+
+// Precomputed coordinate maps and periods for one buffer size
+struct render_plan;
+
+// Pattern coverage of a buffer: one bit per pixel, set where it shows bg
+// Independent of the colors, so a buffer can be recolored from it alone
+struct render_mask;
+
+// A horizontal band of a buffer, rendered as one worker pool job
+// Usually full width; [x_begin, x_end) narrows it to newly exposed columns
+struct render_band {
+    const struct render_plan *plan;
+    const struct render_mask *mask;  // recolor whole rows from this instead
+    void *data;  // start of the buffer, not of the band
+    uint32_t stride;
+    uint32_t x_begin;
+    uint32_t x_end;
+    uint32_t y_begin;
+    uint32_t y_end;
+    bool ok;
+};
+
+// Create a render plan for a width x height buffer
+// Returns NULL on allocation failure
+struct render_plan *render_plan_create(const struct render_params *params,
+                                       uint32_t width, uint32_t height);
+
+// Destroy a render plan
+void render_plan_destroy(struct render_plan *plan);
+
+// Bytes per pixel of a pixel format
+unsigned int pixel_format_bytes(enum pixel_format format);
+
+// Pack an ARGB8888 color into a pixel format
+uint32_t pixel_format_pack(enum pixel_format format, uint32_t argb);
+
+// Render rows [y_begin, y_end) of the plan in the params' pixel format
+// data points at row y_begin and stride is in bytes, so a band can be
+// rendered into a buffer of its own. Disjoint bands may be rendered
+// concurrently from the same plan
+bool render_plan_rows(const struct render_plan *plan, void *data,
+                      uint32_t stride, uint32_t y_begin, uint32_t y_end);
+
+// Render only columns [x_begin, x_end) of rows [y_begin, y_end)
+// data points at the start of row y_begin; other pixels are left untouched
+bool render_plan_rect(const struct render_plan *plan, void *data, uint32_t stride,
+                      uint32_t x_begin, uint32_t x_end,
+                      uint32_t y_begin, uint32_t y_end);
+
+// Take the coverage mask of a width x height buffer rendered with params
+// Only one vertical period of rows is stored. Returns NULL if the render
+// blends colors, as the box filter does at most scales, or on failure
+struct render_mask *render_mask_create(const struct render_params *params,
+                                       uint32_t width, uint32_t height);
+
+// Destroy a mask
+void render_mask_destroy(struct render_mask *mask);
+
+// Whether a mask covers a width x height buffer rendered with params
+// Colors and pixel format are ignored
+bool render_mask_matches(const struct render_mask *mask, const struct render_params *params,
+                         uint32_t width, uint32_t height);
+
+// Rewrite rows [y_begin, y_end) from a mask in the plan's colors and format
+// Each row is one bit expansion, so no pattern is evaluated. data points
+// at row y_begin. Returns false if the mask doesn't match the plan's size
+bool render_plan_recolor(const struct render_plan *plan, const struct render_mask *mask,
+                         void *data, uint32_t stride, uint32_t y_begin, uint32_t y_end);
+
+// Worker pool entry point for a struct render_band
+void render_band_run(void *data);
+
+// Size of a tile that repeats seamlessly across a width x height buffer
+// Each side is the smallest multiple of both the pattern's exact period
+// along that axis and align reaching min_size, or the buffer's own side if
+// that is no smaller. Returns false on allocation failure
+bool render_tile_size(const struct render_params *params, uint32_t width, uint32_t height,
+                      uint32_t min_size, uint32_t align,
+                      uint32_t *tile_width, uint32_t *tile_height);
+
+// Render the pattern tiled across a whole buffer
+// stride is in bytes. Returns false on allocation failure
+bool render_pattern(const struct render_params *params, void *data,
+                    uint32_t width, uint32_t height, uint32_t stride);
+
+#endif // RENDER_H
@@ -0,0 +1,22 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+struct worker_pool;
+
+// Create a pool of worker threads
+// With threads <= 1 jobs run synchronously in worker_pool_submit()
+struct worker_pool *worker_pool_create(unsigned int threads);
+
+// Destroy a pool, waiting for queued jobs to finish first
+void worker_pool_destroy(struct worker_pool *pool);
+
+// Number of threads jobs are spread over
+unsigned int worker_pool_size(const struct worker_pool *pool);
+
+// Queue a job. If it cannot be queued it runs synchronously instead
+void worker_pool_submit(struct worker_pool *pool, void (*fn)(void *), void *data);
+
+// Block until every submitted job has finished
+void worker_pool_wait(struct worker_pool *pool);
+
+#endif // WORKER_POOL_H
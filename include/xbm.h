@@ -2,20 +2,41 @@
 #define XBM_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+// Byte-padded rows of bits; XBM stores them LSB first, PBM MSB first
 struct xbm_image {
     unsigned int width;
     unsigned int height;
     unsigned char *bits;
     int hotspot_x;  // -1 if not defined
     int hotspot_y;  // -1 if not defined
+    bool msb_first;  // bit order within each byte
+    void *mapping;  // file mapping bits points into, NULL if bits is allocated
+    size_t mapping_size;
 };
 
 // Parse an XBM file and return an xbm_image structure
+// Malformed files are rejected with the line of the first error.
 // Returns NULL on failure
 struct xbm_image *xbm_load(const char *filename);
 
+// Parse XBM text held in memory; name is used in error messages
+// Returns NULL on failure
+struct xbm_image *xbm_parse(const char *data, size_t size, const char *name);
+
+// Map a binary PBM (P4) file and use its rows in place
+// Only the header is parsed, so loading takes the same time for any size.
+// The file must not be truncated while the image is in use. Returns NULL
+// on failure
+struct xbm_image *pbm_load(const char *filename);
+
+// Create an xbm_image from bits in XBM layout (LSB first, byte-padded rows)
+// bits may be NULL for an all-zero image. Returns NULL on failure
+struct xbm_image *xbm_create(unsigned int width, unsigned int height,
+                             const unsigned char *bits);
+
 // Free an xbm_image structure
 void xbm_free(struct xbm_image *image);
 
@@ -0,0 +1,225 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "bit-expand.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define HAVE_NEON_KERNEL 1
+#endif
+
+// Kernels take the bit order as flip: pixel i of a byte is bit (i ^ flip),
+// 0 for LSB first and 7 for MSB first
+typedef void (*expand_fn)(uint32_t *dst, const unsigned char *src, size_t bytes,
+                          uint32_t zero_color, uint32_t diff, unsigned int flip);
+typedef void (*expand16_fn)(uint16_t *dst, const unsigned char *src, size_t bytes,
+                            uint16_t zero_color, uint16_t diff, unsigned int flip);
+
+// Expand whole bytes, 8 pixels per byte, one bit at a time
+static void expand_scalar(uint32_t *dst, const unsigned char *src, size_t bytes,
+                          uint32_t zero_color, uint32_t diff, unsigned int flip) {
+    for (size_t i = 0; i < bytes; i++) {
+        unsigned int b = src[i];
+        for (unsigned int bit = 0; bit < 8; bit++) {
+            dst[bit] = zero_color ^ (diff & -((b >> (bit ^ flip)) & 1u));
+        }
+        dst += 8;
+    }
+}
+
+static void expand16_scalar(uint16_t *dst, const unsigned char *src, size_t bytes,
+                            uint16_t zero_color, uint16_t diff, unsigned int flip) {
+    for (size_t i = 0; i < bytes; i++) {
+        unsigned int b = src[i];
+        for (unsigned int bit = 0; bit < 8; bit++) {
+            dst[bit] = zero_color ^ (diff & -(uint16_t)((b >> (bit ^ flip)) & 1u));
+        }
+        dst += 8;
+    }
+}
+
+#ifdef HAVE_X86_KERNELS
+// Eight 16-bit pixels fill one register, so test the bits in place
+__attribute__((target("sse2")))
+static void expand16_sse2(uint16_t *dst, const unsigned char *src, size_t bytes,
+                          uint16_t zero_color, uint16_t diff, unsigned int flip) {
+    __m128i zero = _mm_set1_epi16((short)zero_color);
+    __m128i d = _mm_set1_epi16((short)diff);
+    __m128i select = flip ? _mm_setr_epi16(128, 64, 32, 16, 8, 4, 2, 1)
+                          : _mm_setr_epi16(1, 2, 4, 8, 16, 32, 64, 128);
+    
+    for (size_t i = 0; i < bytes; i++) {
+        __m128i b = _mm_and_si128(_mm_set1_epi16(src[i]), select);
+        __m128i mask = _mm_cmpeq_epi16(b, select);
+        _mm_storeu_si128((__m128i *)dst, _mm_xor_si128(zero, _mm_and_si128(d, mask)));
+        dst += 8;
+    }
+}
+
+// Per-byte pixel masks: expand_masks[0][b][i] is all ones if bit i of b is
+// set, expand_masks[1] holds the same for MSB first bytes
+static uint32_t expand_masks[2][256][8] __attribute__((aligned(16)));
+
+// Blend through the mask LUT, two 128-bit stores per byte
+__attribute__((target("sse2")))
+static void expand_sse2(uint32_t *dst, const unsigned char *src, size_t bytes,
+                        uint32_t zero_color, uint32_t diff, unsigned int flip) {
+    __m128i zero = _mm_set1_epi32((int)zero_color);
+    __m128i d = _mm_set1_epi32((int)diff);
+    uint32_t (*masks)[8] = expand_masks[flip != 0];
+    
+    for (size_t i = 0; i < bytes; i++) {
+        const __m128i *mask = (const __m128i *)masks[src[i]];
+        __m128i lo = _mm_xor_si128(zero, _mm_and_si128(d, _mm_load_si128(mask)));
+        __m128i hi = _mm_xor_si128(zero, _mm_and_si128(d, _mm_load_si128(mask + 1)));
+        _mm_storeu_si128((__m128i *)dst, lo);
+        _mm_storeu_si128((__m128i *)(dst + 4), hi);
+        dst += 8;
+    }
+}
+
+// Build the mask in registers: broadcast the byte, test one bit per lane
+__attribute__((target("avx2")))
+static void expand_avx2(uint32_t *dst, const unsigned char *src, size_t bytes,
+                        uint32_t zero_color, uint32_t diff, unsigned int flip) {
+    __m256i zero = _mm256_set1_epi32((int)zero_color);
+    __m256i d = _mm256_set1_epi32((int)diff);
+    __m256i select = flip ? _mm256_setr_epi32(128, 64, 32, 16, 8, 4, 2, 1)
+                          : _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    
+    for (size_t i = 0; i < bytes; i++) {
+        __m256i b = _mm256_and_si256(_mm256_set1_epi32(src[i]), select);
+        __m256i mask = _mm256_cmpeq_epi32(b, select);
+        _mm256_storeu_si256((__m256i *)dst,
+                            _mm256_xor_si256(zero, _mm256_and_si256(d, mask)));
+        dst += 8;
+    }
+}
+#endif
+
+#ifdef HAVE_NEON_KERNEL
+static void expand16_neon(uint16_t *dst, const unsigned char *src, size_t bytes,
+                          uint16_t zero_color, uint16_t diff, unsigned int flip) {
+    static const uint16_t select_bits[2][8] = {
+        { 1, 2, 4, 8, 16, 32, 64, 128 },
+        { 128, 64, 32, 16, 8, 4, 2, 1 },
+    };
+    uint16x8_t zero = vdupq_n_u16(zero_color);
+    uint16x8_t d = vdupq_n_u16(diff);
+    uint16x8_t select = vld1q_u16(select_bits[flip != 0]);
+    
+    for (size_t i = 0; i < bytes; i++) {
+        uint16x8_t mask = vtstq_u16(vdupq_n_u16(src[i]), select);
+        vst1q_u16(dst, veorq_u16(zero, vandq_u16(d, mask)));
+        dst += 8;
+    }
+}
+
+static void expand_neon(uint32_t *dst, const unsigned char *src, size_t bytes,
+                        uint32_t zero_color, uint32_t diff, unsigned int flip) {
+    static const uint32_t select_bits[2][8] = {
+        { 1, 2, 4, 8, 16, 32, 64, 128 },
+        { 128, 64, 32, 16, 8, 4, 2, 1 },
+    };
+    uint32x4_t zero = vdupq_n_u32(zero_color);
+    uint32x4_t d = vdupq_n_u32(diff);
+    uint32x4_t sel_lo = vld1q_u32(select_bits[flip != 0]);
+    uint32x4_t sel_hi = vld1q_u32(select_bits[flip != 0] + 4);
+    
+    for (size_t i = 0; i < bytes; i++) {
+        uint32x4_t b = vdupq_n_u32(src[i]);
+        uint32x4_t lo = vtstq_u32(b, sel_lo);
+        uint32x4_t hi = vtstq_u32(b, sel_hi);
+        vst1q_u32(dst, veorq_u32(zero, vandq_u32(d, lo)));
+        vst1q_u32(dst + 4, veorq_u32(zero, vandq_u32(d, hi)));
+        dst += 8;
+    }
+}
+#endif
+
+static expand_fn expand_kernel = expand_scalar;
+static expand16_fn expand16_kernel = expand16_scalar;
+static const char *expand_kernel_name = "scalar";
+
+void bit_expand_init(void) {
+#ifdef HAVE_X86_KERNELS
+    for (unsigned int b = 0; b < 256; b++) {
+        for (unsigned int bit = 0; bit < 8; bit++) {
+            expand_masks[0][b][bit] = ((b >> bit) & 1) ? UINT32_MAX : 0;
+            expand_masks[1][b][bit] = ((b >> (7 - bit)) & 1) ? UINT32_MAX : 0;
+        }
+    }
+    
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        expand_kernel = expand_sse2;
+        expand16_kernel = expand16_sse2;
+        expand_kernel_name = "sse2";
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        expand_kernel = expand_avx2;
+        expand_kernel_name = "avx2";
+    }
+#endif
+#ifdef HAVE_NEON_KERNEL
+    expand_kernel = expand_neon;
+    expand16_kernel = expand16_neon;
+    expand_kernel_name = "neon";
+#endif
+}
+
+const char *bit_expand_kernel_name(void) {
+    return expand_kernel_name;
+}
+
+static void expand_bits(uint32_t *dst, const unsigned char *src, size_t count,
+                        uint32_t zero_color, uint32_t one_color, unsigned int flip) {
+    uint32_t diff = zero_color ^ one_color;
+    size_t bytes = count / 8;
+    
+    expand_kernel(dst, src, bytes, zero_color, diff, flip);
+    
+    // Trailing bits of a partial byte
+    dst += bytes * 8;
+    for (size_t bit = 0; bit < count % 8; bit++) {
+        dst[bit] = ((src[bytes] >> (bit ^ flip)) & 1) ? one_color : zero_color;
+    }
+}
+
+static void expand_bits16(uint16_t *dst, const unsigned char *src, size_t count,
+                          uint16_t zero_color, uint16_t one_color, unsigned int flip) {
+    uint16_t diff = zero_color ^ one_color;
+    size_t bytes = count / 8;
+    
+    expand16_kernel(dst, src, bytes, zero_color, diff, flip);
+    
+    // Trailing bits of a partial byte
+    dst += bytes * 8;
+    for (size_t bit = 0; bit < count % 8; bit++) {
+        dst[bit] = ((src[bytes] >> (bit ^ flip)) & 1) ? one_color : zero_color;
+    }
+}
+
+void bit_expand(uint32_t *dst, const unsigned char *src, size_t count,
+                uint32_t zero_color, uint32_t one_color) {
+    expand_bits(dst, src, count, zero_color, one_color, 0);
+}
+
+void bit_expand16(uint16_t *dst, const unsigned char *src, size_t count,
+                  uint16_t zero_color, uint16_t one_color) {
+    expand_bits16(dst, src, count, zero_color, one_color, 0);
+}
+
+void bit_expand_msb(uint32_t *dst, const unsigned char *src, size_t count,
+                    uint32_t zero_color, uint32_t one_color) {
+    expand_bits(dst, src, count, zero_color, one_color, 7);
+}
+
+void bit_expand16_msb(uint16_t *dst, const unsigned char *src, size_t count,
+                      uint16_t zero_color, uint16_t one_color) {
+    expand_bits16(dst, src, count, zero_color, one_color, 7);
+}
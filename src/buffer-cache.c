@@ -0,0 +1,62 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "buffer-cache.h"
+
+#include <stdlib.h>
+
+bool buffer_key_equal(const struct buffer_key *a, const struct buffer_key *b) {
+    // Pattern images are compared by identity; there is one per process
+    return a->width == b->width &&
+           a->height == b->height &&
+           a->format == b->format &&
+           a->params.image == b->params.image &&
+           a->params.scale == b->params.scale &&
+           a->params.fg == b->params.fg &&
+           a->params.bg == b->params.bg &&
+           a->params.format == b->params.format &&
+           a->params.filter == b->params.filter;
+}
+
+void buffer_cache_init(struct buffer_cache *cache) {
+    wl_list_init(&cache->buffers);
+}
+
+struct shared_buffer *buffer_cache_find(struct buffer_cache *cache,
+                                        const struct buffer_key *key) {
+    struct shared_buffer *buf;
+    wl_list_for_each(buf, &cache->buffers, link) {
+        if (buffer_key_equal(&buf->key, key)) {
+            buf->refs++;
+            return buf;
+        }
+    }
+    return NULL;
+}
+
+struct shared_buffer *buffer_cache_add(struct buffer_cache *cache,
+                                       const struct buffer_key *key,
+                                       struct shm_arena *arena) {
+    struct shared_buffer *buf = calloc(1, sizeof(*buf));
+    if (!buf) {
+        return NULL;
+    }
+    
+    buf->key = *key;
+    buffer_pool_init(&buf->pool, arena);
+    buf->refs = 1;
+    wl_list_insert(&cache->buffers, &buf->link);
+    return buf;
+}
+
+void shared_buffer_unref(struct shared_buffer *buf) {
+    if (!buf || --buf->refs > 0) {
+        return;
+    }
+    
+    wl_list_remove(&buf->link);
+    render_plan_destroy(buf->plan);
+    free(buf->bands);
+    render_mask_destroy(buf->mask);
+    buffer_pool_finish(&buf->pool);
+    free(buf);
+}
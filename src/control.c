@@ -0,0 +1,231 @@
+#define _GNU_SOURCE
+
+#include "control.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// How long the daemon waits for a connected client to send its command
+#define CONTROL_READ_TIMEOUT_MS 1000
+
+bool control_socket_path(char *path, size_t size) {
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    if (!dir || !*dir) {
+        fprintf(stderr, "XDG_RUNTIME_DIR is not set\n");
+        return false;
+    }
+    
+    int len = snprintf(path, size, "%s/wlrsetroot.sock", dir);
+    if (len < 0 || (size_t)len >= size ||
+        (size_t)len >= sizeof(((struct sockaddr_un *)NULL)->sun_path)) {
+        fprintf(stderr, "Control socket path too long\n");
+        return false;
+    }
+    return true;
+}
+
+static void socket_address(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strncpy(addr->sun_path, path, sizeof(addr->sun_path) - 1);
+}
+
+// Whether a daemon answers on path
+static bool socket_in_use(const struct sockaddr_un *addr) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+    bool in_use = connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) == 0;
+    close(fd);
+    return in_use;
+}
+
+int control_listen(const char *path) {
+    struct sockaddr_un addr;
+    socket_address(path, &addr);
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to create control socket: %s\n", strerror(errno));
+        return -1;
+    }
+    
+    int ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    if (ret < 0 && errno == EADDRINUSE) {
+        if (socket_in_use(&addr)) {
+            fprintf(stderr, "Another wlrsetroot daemon is listening on %s\n", path);
+            close(fd);
+            return -1;
+        }
+        unlink(path);
+        ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    }
+    if (ret < 0 || listen(fd, 4) < 0) {
+        fprintf(stderr, "Failed to listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Split a message of NUL terminated arguments
+static bool split_args(char *buf, size_t len, char *argv[], int max_args, int *argc) {
+    if (len == 0 || buf[len - 1] != '\0') {
+        return false;
+    }
+    
+    int count = 0;
+    for (size_t pos = 0; pos < len; pos += strlen(buf + pos) + 1) {
+        if (count == max_args - 1) {
+            return false;
+        }
+        argv[count++] = buf + pos;
+    }
+    argv[count] = NULL;
+    *argc = count;
+    return true;
+}
+
+int control_accept(int listen_fd, char *buf, size_t size,
+                   char *argv[], int max_args, int *argc) {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    // A client that connects and stalls must not hang the daemon
+    struct timeval timeout = {
+        .tv_sec = CONTROL_READ_TIMEOUT_MS / 1000,
+        .tv_usec = (CONTROL_READ_TIMEOUT_MS % 1000) * 1000,
+    };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    
+    size_t len = 0;
+    for (;;) {
+        if (len == size) {
+            control_reply(fd, "error command too long");
+            return -1;
+        }
+        ssize_t n = read(fd, buf + len, size - len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            control_reply(fd, "error %s", strerror(errno));
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        len += (size_t)n;
+    }
+    
+    // Probes by a second daemon checking for this one send nothing
+    if (len == 0) {
+        close(fd);
+        return -1;
+    }
+    if (!split_args(buf, len, argv, max_args, argc)) {
+        control_reply(fd, "error malformed command");
+        return -1;
+    }
+    return fd;
+}
+
+void control_reply(int fd, const char *fmt, ...) {
+    char line[256];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(line, sizeof(line) - 1, fmt, args);
+    va_end(args);
+    if (len < 0) {
+        len = 0;
+    } else if ((size_t)len > sizeof(line) - 2) {
+        len = sizeof(line) - 2;
+    }
+    line[len++] = '\n';
+    
+    // The client may already be gone, which must not raise SIGPIPE
+    if (send(fd, line, (size_t)len, MSG_NOSIGNAL) < 0) {
+        fprintf(stderr, "Failed to reply to control client: %s\n", strerror(errno));
+    }
+    close(fd);
+}
+
+// Write all of buf, retrying short writes
+static bool write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return false;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+bool control_send(const char *path, int argc, char *argv[],
+                  char *reply, size_t size) {
+    struct sockaddr_un addr;
+    socket_address(path, &addr);
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to create socket: %s\n", strerror(errno));
+        return false;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "No wlrsetroot daemon on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+    
+    size_t total = 0;
+    for (int i = 0; i < argc; i++) {
+        size_t len = strlen(argv[i]) + 1;
+        total += len;
+        if (total > CONTROL_MAX_MESSAGE || !write_all(fd, argv[i], len)) {
+            fprintf(stderr, "Failed to send command\n");
+            close(fd);
+            return false;
+        }
+    }
+    shutdown(fd, SHUT_WR);
+    
+    size_t len = 0;
+    while (len + 1 < size) {
+        ssize_t n = read(fd, reply + len, size - 1 - len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        len += (size_t)n;
+    }
+    close(fd);
+    
+    // The reply is a single line
+    reply[len] = '\0';
+    char *newline = strchr(reply, '\n');
+    if (newline) {
+        *newline = '\0';
+    }
+    if (len == 0) {
+        fprintf(stderr, "No reply from daemon\n");
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,149 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "image-file.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Rows rendered per chunk before they are converted and written
+#define CHUNK_ROWS 64
+
+enum image_file_format image_file_format_from_name(const char *path) {
+    const char *ext = strrchr(path, '.');
+    if (ext && strcasecmp(ext, ".pam") == 0) {
+        return IMAGE_FILE_PAM;
+    }
+    if (ext && (strcasecmp(ext, ".ff") == 0 || strcasecmp(ext, ".farbfeld") == 0)) {
+        return IMAGE_FILE_FARBFELD;
+    }
+    return IMAGE_FILE_PPM;
+}
+
+static bool write_header(FILE *fp, enum image_file_format format,
+                         uint32_t width, uint32_t height) {
+    switch (format) {
+    case IMAGE_FILE_PPM:
+        return fprintf(fp, "P6\n%u %u\n255\n", width, height) > 0;
+    case IMAGE_FILE_PAM:
+        return fprintf(fp, "P7\nWIDTH %u\nHEIGHT %u\nDEPTH 4\nMAXVAL 255\n"
+                       "TUPLTYPE RGB_ALPHA\nENDHDR\n", width, height) > 0;
+    case IMAGE_FILE_FARBFELD: {
+        // Magic, then big-endian width and height
+        unsigned char header[16] = { 'f', 'a', 'r', 'b', 'f', 'e', 'l', 'd' };
+        for (int i = 0; i < 4; i++) {
+            header[8 + i] = (unsigned char)(width >> (24 - 8 * i));
+            header[12 + i] = (unsigned char)(height >> (24 - 8 * i));
+        }
+        return fwrite(header, sizeof(header), 1, fp) == 1;
+    }
+    }
+    return false;
+}
+
+// Bytes per pixel in the file
+static size_t file_pixel_size(enum image_file_format format) {
+    switch (format) {
+    case IMAGE_FILE_PPM:
+        return 3;
+    case IMAGE_FILE_PAM:
+        return 4;
+    case IMAGE_FILE_FARBFELD:
+        return 8;
+    }
+    return 0;
+}
+
+// Convert one row of ARGB8888 pixels to the file's pixel layout
+static void convert_row(unsigned char *dst, const uint32_t *src, uint32_t width,
+                        enum image_file_format format) {
+    for (uint32_t x = 0; x < width; x++) {
+        uint32_t p = src[x];
+        unsigned char r = p >> 16, g = p >> 8, b = p, a = p >> 24;
+        
+        switch (format) {
+        case IMAGE_FILE_PPM:
+            *dst++ = r;
+            *dst++ = g;
+            *dst++ = b;
+            break;
+        case IMAGE_FILE_PAM:
+            *dst++ = r;
+            *dst++ = g;
+            *dst++ = b;
+            *dst++ = a;
+            break;
+        case IMAGE_FILE_FARBFELD:
+            // 16-bit big-endian channels; v * 257 widens 8 to 16 bits
+            *dst++ = r;
+            *dst++ = r;
+            *dst++ = g;
+            *dst++ = g;
+            *dst++ = b;
+            *dst++ = b;
+            *dst++ = a;
+            *dst++ = a;
+            break;
+        }
+    }
+}
+
+bool image_file_render(const char *path, enum image_file_format format,
+                       const struct render_params *params,
+                       uint32_t width, uint32_t height) {
+    bool to_stdout = strcmp(path, "-") == 0;
+    FILE *fp = to_stdout ? stdout : fopen(path, "wb");
+    if (!fp) {
+        fprintf(stderr, "Failed to open '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+    
+    // Files are converted from ARGB8888 whatever the params ask for
+    struct render_params argb = *params;
+    argb.format = PIXEL_FORMAT_ARGB8888;
+    
+    uint32_t stride = width * 4;
+    size_t file_row = (size_t)width * file_pixel_size(format);
+    struct render_plan *plan = render_plan_create(&argb, width, height);
+    uint32_t *pixels = malloc((size_t)stride * CHUNK_ROWS);
+    unsigned char *row = malloc(file_row);
+    bool ok = plan && pixels && row;
+    bool io_ok = true;
+    
+    if (!ok) {
+        fprintf(stderr, "Failed to allocate render buffers\n");
+    } else {
+        io_ok = write_header(fp, format, width, height);
+    }
+    
+    for (uint32_t y = 0; ok && io_ok && y < height; y += CHUNK_ROWS) {
+        uint32_t rows = height - y < CHUNK_ROWS ? height - y : CHUNK_ROWS;
+        if (!render_plan_rows(plan, pixels, stride, y, y + rows)) {
+            fprintf(stderr, "Failed to render pattern\n");
+            ok = false;
+            break;
+        }
+        
+        for (uint32_t i = 0; io_ok && i < rows; i++) {
+            convert_row(row, pixels + (size_t)i * width, width, format);
+            io_ok = fwrite(row, file_row, 1, fp) == 1;
+        }
+    }
+    
+    if (fflush(fp) != 0) {
+        io_ok = false;
+    }
+    if (!to_stdout && fclose(fp) != 0) {
+        io_ok = false;
+    }
+    if (!io_ok) {
+        fprintf(stderr, "Failed to write '%s': %s\n", path, strerror(errno));
+    }
+    
+    render_plan_destroy(plan);
+    free(pixels);
+    free(row);
+    return ok && io_ok;
+}
@@ -1,16 +1,33 @@
-#define _POSIX_C_SOURCE 200809L
+#define _XOPEN_SOURCE 700
 
 #include <ctype.h>
+#include <errno.h>
 #include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
 #include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <wayland-client.h>
 
+#include "bit-expand.h"
+#include "buffer-cache.h"
+#include "builtin-patterns.h"
+#include "control.h"
+#include "image-file.h"
 #include "pool-buffer.h"
+#include "render.h"
+#include "render-cache.h"
+#include "worker-pool.h"
 #include "xbm.h"
+#include "single-pixel-buffer-v1-client-protocol.h"
+#include "viewporter-client-protocol.h"
+#include "fractional-scale-v1-client-protocol.h"
 #include "wlr-layer-shell-unstable-v1-client-protocol.h"
 
 #define VERSION "0.1.0"
@@ -20,12 +37,54 @@ static const unsigned char gray_bits[] = { 0x01, 0x02 };
 #define GRAY_WIDTH 2
 #define GRAY_HEIGHT 2
 
+// Modula patterns are built as a 16x16 tile
+#define MOD_SIZE 16
+
+// Upper bound for -threads
+#define MAX_THREADS 64
+
+// Upper bound for each -size dimension
+#define MAX_FILE_SIZE 32768
+
+// Minimum rows per render band, so small outputs are not over-split
+#define MIN_BAND_ROWS 64
+
+// Upper bound for -cache-size, in MiB
+#define MAX_CACHE_SIZE_MB 65536
+
+// Upper bound for each side of the -span canvas in device pixels
+#define MAX_CANVAS_SIZE 32768
+
+// Smallest side of a -tile buffer in device pixels, before rounding up to
+// the pattern period; large enough to keep the subsurface count low
+#define TILE_MIN_SIZE 256
+
+// Interval between -cycle color steps, and the longest period accepted
+#define CYCLE_STEP_MS 50
+#define MAX_CYCLE_SECONDS 86400
+
 // Pattern type enum
 enum pattern_type {
     PATTERN_NONE,
     PATTERN_XBM,
     PATTERN_GRAY,
     PATTERN_MOD,
+    PATTERN_BUILTIN,
+    PATTERN_PBM,
+};
+
+// Everything about the wallpaper a command line or control command sets
+struct pattern_options {
+    enum pattern_type pattern;
+    const char *pattern_file;  // -bitmap or -pbm file, until the tile is loaded
+    const struct builtin_pattern *builtin;  // -builtin pattern
+    int mod_x;  // modula pattern x spacing
+    int mod_y;  // modula pattern y spacing
+    uint32_t fg_color;  // ARGB format
+    uint32_t bg_color;  // ARGB format
+    float pattern_scale;  // Scale factor for XBM pattern (default 1.0)
+    enum render_filter filter;  // sampling at fractional pattern scales
+    bool reverse;  // swap fg/bg colors
 };
 
 // Global state
@@ -33,21 +92,66 @@ struct wlrsetroot_state {
     struct wl_display *display;
     struct wl_registry *registry;
     struct wl_compositor *compositor;
+    struct wl_subcompositor *subcompositor;  // optional, for -tile
     struct wl_shm *shm;
+    struct shm_arena *arena;  // backs every shm buffer
+    uint32_t shm_format;  // wl_shm format of rendered buffers
+    enum pixel_format pixel_format;  // matching render format
+    bool format_chosen;  // shm_format is set
+    bool formats_known;  // wl_shm has sent all of its formats
+    struct wl_callback *shm_sync;  // fires once it has
+    bool shm_rgb565;  // compositor advertised RGB565
+    bool rgb565;  // -rgb565: prefer the 16-bit format
+    bool hugepages;  // try explicit huge pages for the arena
+    bool low_rss;  // -low-rss: keep the arena unmapped between renders
+    unsigned long rss_peak_reported;  // VmHWM in KiB at the last -low-rss report
+    bool tile;  // -tile: show patterns as a grid of one shared tile
+    bool span;  // -span: one canvas across the global output layout
+    float cycle_period;  // -cycle seconds, 0 when the colors stay put
+    float cycle_mix;  // how far fg and bg have blended into each other
+    int64_t cycle_step;  // last -cycle step taken
+    struct timespec cycle_start;
     struct zwlr_layer_shell_v1 *layer_shell;
+    struct wp_viewporter *viewporter;  // optional
+    struct wp_fractional_scale_manager_v1 *fractional_scale;  // optional
+    struct wp_single_pixel_buffer_manager_v1 *single_pixel;  // optional
     
     struct wl_list outputs;  // list of wlrsetroot_output
+    struct buffer_cache buffers;  // buffers shared between outputs
     
-    enum pattern_type pattern;
-    struct xbm_image *xbm;
-    int mod_x;  // modula pattern x spacing
-    int mod_y;  // modula pattern y spacing
-    uint32_t fg_color;  // ARGB format
-    uint32_t bg_color;  // ARGB format
-    float pattern_scale;  // Scale factor for XBM pattern (default 1.0)
-    bool reverse;  // swap fg/bg colors
+    // -span canvas, which every output shows a view of
+    struct shared_buffer *canvas;  // NULL until first rendered
+    int32_t canvas_x;  // global position of the canvas origin
+    int32_t canvas_y;
+    int32_t canvas_scale;  // device pixels per logical pixel of the canvas
+    
+    struct pattern_options options;
+    struct xbm_image *xbm;  // pattern tile for -bitmap, -pbm, -gray and -mod
+    struct xbm_image **old_images;  // replaced tiles still keying buffers
+    size_t old_image_count;
     
+    struct worker_pool *workers;
+    unsigned int threads;  // render threads, 0 = one per CPU
+    
+    struct render_cache *render_cache;  // NULL if disabled or unavailable
+    size_t render_cache_size;  // -cache-size, 0 disables the cache
+    
+    bool ready;  // globals bound and pattern loaded, surfaces may be created
     bool running;
+    
+    // -daemon control socket
+    int control_fd;  // listening socket, -1 without -daemon
+    char control_path[CONTROL_PATH_MAX];
+    int control_client;  // client awaiting its reply, -1 if none
+    struct timespec control_start;  // when the client's command arrived
+    struct wl_callback *control_sync;  // fires once the change is committed
+};
+
+// A cell of a tiled output's grid, showing the shared tile buffer
+struct output_tile {
+    struct wl_surface *surface;
+    struct wl_subsurface *subsurface;
+    struct wp_viewport *viewport;  // crops cells at the right and bottom edges
 };
 
 struct wlrsetroot_output {
@@ -59,14 +163,38 @@ struct wlrsetroot_output {
     
     struct wl_surface *surface;
     struct zwlr_layer_surface_v1 *layer_surface;
-    struct pool_buffer buffer;
+    struct wp_viewport *viewport;
+    struct wp_fractional_scale_v1 *fractional_scale;
+    struct shared_buffer *buffer;  // reference into state->buffers
+    struct shared_buffer *speculative;  // rendered at the mode before configure
+    struct output_tile *tiles;  // -tile cells besides the layer surface itself
+    uint32_t tile_count;
+    struct pool_buffer_view *view;  // -span part of the canvas on screen
+    int32_t view_x;  // global rectangle view was made for
+    int32_t view_y;
+    uint32_t view_width;
+    uint32_t view_height;
     
     uint32_t width;
     uint32_t height;
+    int32_t x;  // position in the global compositor space
+    int32_t y;
     int32_t scale;
+    uint32_t preferred_scale;  // fractional scale in 120ths, 0 until sent
+    int32_t preferred_buffer_scale;  // 0 until sent
+    int32_t mode_width;  // current mode in hardware pixels
+    int32_t mode_height;
+    int32_t transform;
+    bool done;  // initial output properties received
     
     bool configured;
+    bool configure_pending;  // configure_serial not acked yet
+    bool dirty;              // size or scale may have changed since the last render
+    bool needs_commit;       // buffer is being rendered for this configure
     uint32_t configure_serial;
+    
+    struct shared_buffer *retired;    // previous buffer, released after the commit
+    struct wl_buffer *stale_buffer;   // previous wl_buffer of a reshaped buffer
 };
 
 // Parse color string like "#rrggbb" or "rrggbb"
@@ -96,86 +224,335 @@ static bool parse_color(const char *str, uint32_t *color) {
     return true;
 }
 
-// Get pixel from built-in gray pattern (2x2 checkerboard)
-static int gray_get_pixel(unsigned int x, unsigned int y) {
-    size_t byte_index = y * ((GRAY_WIDTH + 7) / 8) + x / 8;
-    unsigned int bit_index = x % 8;
-    return (gray_bits[byte_index] >> bit_index) & 1;
+// Build the modula pattern tile (like xsetroot's MakeModulaBitmap)
+// Creates a 16x16 grid pattern based on mod_x and mod_y spacing
+static struct xbm_image *make_mod_image(int mod_x, int mod_y) {
+    unsigned char bits[MOD_SIZE * MOD_SIZE / 8] = {0};
+    
+    for (unsigned int y = 0; y < MOD_SIZE; y++) {
+        for (unsigned int x = 0; x < MOD_SIZE; x++) {
+            // Every mod_y'th row and every mod_x'th column is lit
+            if ((y % mod_y) == 0 || (x % mod_x) == 0) {
+                bits[y * (MOD_SIZE / 8) + x / 8] |= 1 << (x % 8);
+            }
+        }
+    }
+    return xbm_create(MOD_SIZE, MOD_SIZE, bits);
 }
 
-// Get pixel from modula pattern (like xsetroot's MakeModulaBitmap)
-// Creates a 16x16 grid pattern based on mod_x and mod_y spacing
-static int mod_get_pixel(int mod_x, int mod_y, unsigned int x, unsigned int y) {
-    // Wrap to 16x16 tile
-    x = x % 16;
-    y = y % 16;
+// Build the pattern tile the options describe
+// Returns NULL for solid colors, and on failure with *ok cleared
+static struct xbm_image *build_pattern(const struct pattern_options *options, bool *ok) {
+    struct xbm_image *xbm = NULL;
     
-    // Every mod_y'th row is fully lit
-    if ((y % mod_y) == 0) {
-        return 1;
+    if (options->pattern == PATTERN_XBM) {
+        xbm = xbm_load(options->pattern_file);
+        if (!xbm) {
+            fprintf(stderr, "Failed to load XBM file: %s\n", options->pattern_file);
+            *ok = false;
+            return NULL;
+        }
+    } else if (options->pattern == PATTERN_PBM) {
+        xbm = pbm_load(options->pattern_file);
+        if (!xbm) {
+            fprintf(stderr, "Failed to load PBM file: %s\n", options->pattern_file);
+            *ok = false;
+            return NULL;
+        }
+    } else if (options->pattern == PATTERN_GRAY) {
+        xbm = xbm_create(GRAY_WIDTH, GRAY_HEIGHT, gray_bits);
+    } else if (options->pattern == PATTERN_MOD) {
+        xbm = make_mod_image(options->mod_x, options->mod_y);
+    } else if (options->pattern == PATTERN_BUILTIN) {
+        xbm = xbm_create(options->builtin->width, options->builtin->height,
+                         options->builtin->bits);
     }
-    // Every mod_x'th column is lit
-    if ((x % mod_x) == 0) {
-        return 1;
+    
+    *ok = options->pattern == PATTERN_NONE || xbm;
+    if (!*ok) {
+        fprintf(stderr, "Failed to create pattern\n");
     }
-    return 0;
+    return xbm;
 }
 
-// Render the pattern tiled across the buffer
-static void render_tiled_pattern(struct wlrsetroot_output *output) {
-    struct wlrsetroot_state *state = output->state;
-    uint32_t *pixels = output->buffer.data;
-    uint32_t buf_width = output->buffer.width;
-    uint32_t buf_height = output->buffer.height;
+// Pattern preparation, run on the worker pool during startup
+struct pattern_job {
+    struct wlrsetroot_state *state;
+    bool ok;
+};
+
+// Load the XBM or PBM file if specified, or build the built-in pattern tile
+static void load_pattern(void *data) {
+    struct pattern_job *job = data;
+    job->state->xbm = build_pattern(&job->state->options, &job->ok);
+}
+
+// Look up a compiled-in pattern by name
+// Unknown names are reported along with the available ones
+static const struct builtin_pattern *find_builtin(const char *name) {
+    for (unsigned int i = 0; i < builtin_pattern_count; i++) {
+        if (strcmp(builtin_patterns[i].name, name) == 0) {
+            return &builtin_patterns[i];
+        }
+    }
     
-    // Apply reverse if set
-    uint32_t fg = state->reverse ? state->bg_color : state->fg_color;
-    uint32_t bg = state->reverse ? state->fg_color : state->bg_color;
+    fprintf(stderr, "Unknown built-in pattern: %s\nAvailable:", name);
+    for (unsigned int i = 0; i < builtin_pattern_count; i++) {
+        fprintf(stderr, " %s", builtin_patterns[i].name);
+    }
+    fprintf(stderr, "\n");
+    return NULL;
+}
+
+// Parse the pattern option at argv[*i], advancing *i past its arguments
+// Counts -bitmap, -builtin, -gray, -mod, -pbm and -solid in *excl. -rv
+// toggles when toggle_reverse is set, so a control command can also undo
+// it; on the command line it only sets reverse. Returns 1 if the option
+// was consumed, 0 if it is not a pattern option and -1 if it is invalid
+static int parse_pattern_option(struct pattern_options *options, int *excl,
+                                bool toggle_reverse, int argc, char *argv[], int *i) {
+    const char *arg = argv[*i];
     
-    if (state->pattern == PATTERN_NONE) {
-        // Solid background color
-        for (uint32_t i = 0; i < buf_width * buf_height; i++) {
-            pixels[i] = bg;
+    if (strcmp(arg, "-bitmap") == 0) {
+        if (++*i >= argc) {
+            fprintf(stderr, "Missing argument for -bitmap\n");
+            return -1;
         }
-        return;
+        options->pattern_file = argv[*i];
+        options->pattern = PATTERN_XBM;
+        ++*excl;
+    } else if (strcmp(arg, "-pbm") == 0) {
+        if (++*i >= argc) {
+            fprintf(stderr, "Missing argument for -pbm\n");
+            return -1;
+        }
+        options->pattern_file = argv[*i];
+        options->pattern = PATTERN_PBM;
+        ++*excl;
+    } else if (strcmp(arg, "-builtin") == 0) {
+        if (++*i >= argc) {
+            fprintf(stderr, "Missing argument for -builtin\n");
+            return -1;
+        }
+        options->builtin = find_builtin(argv[*i]);
+        if (!options->builtin) {
+            return -1;
+        }
+        options->pattern = PATTERN_BUILTIN;
+        ++*excl;
+    } else if (strcmp(arg, "-gray") == 0 || strcmp(arg, "-grey") == 0) {
+        options->pattern = PATTERN_GRAY;
+        ++*excl;
+    } else if (strcmp(arg, "-mod") == 0) {
+        if (++*i >= argc) {
+            fprintf(stderr, "Missing x argument for -mod\n");
+            return -1;
+        }
+        options->mod_x = atoi(argv[*i]);
+        if (options->mod_x <= 0) options->mod_x = 1;
+        if (++*i >= argc) {
+            fprintf(stderr, "Missing y argument for -mod\n");
+            return -1;
+        }
+        options->mod_y = atoi(argv[*i]);
+        if (options->mod_y <= 0) options->mod_y = 1;
+        options->pattern = PATTERN_MOD;
+        ++*excl;
+    } else if (strcmp(arg, "-bg") == 0) {
+        if (++*i >= argc) {
+            fprintf(stderr, "Missing argument for -bg\n");
+            return -1;
+        }
+        if (!parse_color(argv[*i], &options->bg_color)) {
+            fprintf(stderr, "Invalid color: %s\n", argv[*i]);
+            return -1;
+        }
+    } else if (strcmp(arg, "-fg") == 0) {
+        if (++*i >= argc) {
+            fprintf(stderr, "Missing argument for -fg\n");
+            return -1;
+        }
+        if (!parse_color(argv[*i], &options->fg_color)) {
+            fprintf(stderr, "Invalid color: %s\n", argv[*i]);
+            return -1;
+        }
+    } else if (strcmp(arg, "-rv") == 0 || strcmp(arg, "-reverse") == 0) {
+        options->reverse = toggle_reverse ? !options->reverse : true;
+    } else if (strcmp(arg, "-scale") == 0) {
+        if (++*i >= argc) {
+            fprintf(stderr, "Missing argument for -scale\n");
+            return -1;
+        }
+        float scale = strtof(argv[*i], NULL);
+        if (scale < 0.1f || scale > 32.0f) {
+            fprintf(stderr, "Scale must be between 0.1 and 32\n");
+            return -1;
+        }
+        options->pattern_scale = scale;
+    } else if (strcmp(arg, "-filter") == 0) {
+        if (++*i >= argc) {
+            fprintf(stderr, "Missing argument for -filter\n");
+            return -1;
+        }
+        if (strcmp(argv[*i], "nearest") == 0) {
+            options->filter = RENDER_FILTER_NEAREST;
+        } else if (strcmp(argv[*i], "box") == 0) {
+            options->filter = RENDER_FILTER_BOX;
+        } else {
+            fprintf(stderr, "Unknown filter: %s\n", argv[*i]);
+            return -1;
+        }
+    } else if (strcmp(arg, "-solid") == 0) {
+        if (++*i >= argc) {
+            fprintf(stderr, "Missing argument for -solid\n");
+            return -1;
+        }
+        if (!parse_color(argv[*i], &options->bg_color)) {
+            fprintf(stderr, "Invalid color: %s\n", argv[*i]);
+            return -1;
+        }
+        options->pattern = PATTERN_NONE;
+        ++*excl;
+    } else {
+        return 0;
     }
+    return 1;
+}
+
+// Blend ARGB color a towards b, channel by channel
+static uint32_t mix_colors(uint32_t a, uint32_t b, float t) {
+    uint32_t mixed = 0;
+    for (unsigned int shift = 0; shift < 32; shift += 8) {
+        float from = (a >> shift) & 0xFF;
+        float to = (b >> shift) & 0xFF;
+        mixed |= (uint32_t)lroundf(from + (to - from) * t) << shift;
+    }
+    return mixed;
+}
+
+// Fill in render parameters from the command line state
+static void get_render_params(const struct wlrsetroot_state *state,
+                              struct render_params *params) {
+    // Apply reverse if set
+    const struct pattern_options *options = &state->options;
+    params->image = options->pattern == PATTERN_NONE ? NULL : state->xbm;
+    params->scale = options->pattern_scale;
+    params->filter = options->filter;
+    params->fg = options->reverse ? options->bg_color : options->fg_color;
+    params->bg = options->reverse ? options->fg_color : options->bg_color;
+    params->format = state->pixel_format;
     
-    float scale = state->pattern_scale;
-    
-    for (uint32_t y = 0; y < buf_height; y++) {
-        for (uint32_t x = 0; x < buf_width; x++) {
-            int pixel = 0;
-            
-            switch (state->pattern) {
-            case PATTERN_XBM: {
-                struct xbm_image *xbm = state->xbm;
-                float xbm_width_f = (float)xbm->width;
-                float xbm_height_f = (float)xbm->height;
-                unsigned int xbm_x = (unsigned int)fmodf(x / scale, xbm_width_f);
-                unsigned int xbm_y = (unsigned int)fmodf(y / scale, xbm_height_f);
-                pixel = xbm_get_pixel(xbm, xbm_x, xbm_y);
-                break;
-            }
-            case PATTERN_GRAY: {
-                unsigned int gray_x = (unsigned int)fmodf(x / scale, (float)GRAY_WIDTH);
-                unsigned int gray_y = (unsigned int)fmodf(y / scale, (float)GRAY_HEIGHT);
-                pixel = gray_get_pixel(gray_x, gray_y);
-                break;
-            }
-            case PATTERN_MOD: {
-                unsigned int mod_px = (unsigned int)(x / scale);
-                unsigned int mod_py = (unsigned int)(y / scale);
-                pixel = mod_get_pixel(state->mod_x, state->mod_y, mod_px, mod_py);
-                break;
-            }
-            default:
-                break;
-            }
-            
-            // XBM convention: 1 = background, 0 = foreground (matches xsetroot)
-            pixels[y * buf_width + x] = pixel ? bg : fg;
+    if (state->cycle_mix > 0) {
+        uint32_t fg = params->fg;
+        params->fg = mix_colors(fg, params->bg, state->cycle_mix);
+        params->bg = mix_colors(params->bg, fg, state->cycle_mix);
+    }
+}
+
+// Solid colors need no render when a viewport can stretch one pixel
+static bool use_solid_pixel(const struct wlrsetroot_state *state) {
+    return state->options.pattern == PATTERN_NONE && state->viewporter;
+}
+
+// Whether the buffer matches the device pixels at a fractional scale
+// The viewport then maps it onto the logical size
+static bool use_fractional_scale(const struct wlrsetroot_output *output) {
+    return output->preferred_scale != 0 && output->state->viewporter;
+}
+
+// Integer buffer scale when no fractional scale is in use
+static int32_t output_buffer_scale(const struct wlrsetroot_output *output) {
+    return output->preferred_buffer_scale ? output->preferred_buffer_scale : output->scale;
+}
+
+// Whether outputs show their part of one -span canvas
+static bool use_span(const struct wlrsetroot_state *state) {
+    return state->span && !use_solid_pixel(state);
+}
+
+// Destroy the output's view of the -span canvas
+static void drop_view(struct wlrsetroot_output *output) {
+    if (output->view) {
+        pool_buffer_view_destroy(output->view);
+        free(output->view);
+        output->view = NULL;
+    }
+}
+
+// Whether the output shows its pattern as a grid of subsurfaces
+// Needs whole logical pixels per tile, so fractional scales render in full
+static bool use_tiles(const struct wlrsetroot_output *output) {
+    const struct wlrsetroot_state *state = output->state;
+    return state->tile && state->options.pattern != PATTERN_NONE &&
+           state->subcompositor && state->viewporter && !use_fractional_scale(output);
+}
+
+// Take no input and let the compositor skip what lies below
+static void set_surface_regions(struct wlrsetroot_state *state, struct wl_surface *surface) {
+    struct wl_region *input_region = wl_compositor_create_region(state->compositor);
+    wl_surface_set_input_region(surface, input_region);
+    wl_region_destroy(input_region);
+    
+    // The wallpaper covers the whole surface, so nothing below needs blending
+    struct wl_region *opaque_region = wl_compositor_create_region(state->compositor);
+    wl_region_add(opaque_region, 0, 0, INT32_MAX, INT32_MAX);
+    wl_surface_set_opaque_region(surface, opaque_region);
+    wl_region_destroy(opaque_region);
+}
+
+static void destroy_tile(struct output_tile *tile) {
+    if (tile->viewport) {
+        wp_viewport_destroy(tile->viewport);
+    }
+    if (tile->subsurface) {
+        wl_subsurface_destroy(tile->subsurface);
+    }
+    if (tile->surface) {
+        wl_surface_destroy(tile->surface);
+    }
+}
+
+// Create or destroy subsurfaces until the output has count of them
+// Returns false on failure, keeping the cells that exist
+static bool resize_tiles(struct wlrsetroot_output *output, uint32_t count) {
+    struct wlrsetroot_state *state = output->state;
+    
+    while (output->tile_count > count) {
+        destroy_tile(&output->tiles[--output->tile_count]);
+    }
+    if (count == 0) {
+        free(output->tiles);
+        output->tiles = NULL;
+        return true;
+    }
+    if (count == output->tile_count) {
+        return true;
+    }
+    
+    struct output_tile *tiles = realloc(output->tiles, count * sizeof(*tiles));
+    if (!tiles) {
+        return false;
+    }
+    output->tiles = tiles;
+    
+    while (output->tile_count < count) {
+        struct output_tile *tile = &tiles[output->tile_count];
+        *tile = (struct output_tile){0};
+        tile->surface = wl_compositor_create_surface(state->compositor);
+        if (!tile->surface) {
+            return false;
         }
+        // Synchronized, so the grid changes with the layer surface's commit
+        tile->subsurface = wl_subcompositor_get_subsurface(state->subcompositor,
+                                                           tile->surface, output->surface);
+        if (!tile->subsurface) {
+            destroy_tile(tile);
+            return false;
+        }
+        set_surface_regions(state, tile->surface);
+        output->tile_count++;
     }
+    return true;
 }
 
 // Layer surface configure handler
@@ -191,6 +568,20 @@ static void layer_surface_configure(void *data,
     output->height = height;
     output->configure_serial = serial;
     output->configured = true;
+    output->configure_pending = true;
+    output->dirty = true;
+}
+
+// Drop what the output showed before its current buffer
+static void release_previous(struct wlrsetroot_output *output) {
+    if (output->stale_buffer) {
+        wl_buffer_destroy(output->stale_buffer);
+        output->stale_buffer = NULL;
+    }
+    if (output->retired) {
+        shared_buffer_unref(output->retired);
+        output->retired = NULL;
+    }
 }
 
 static void layer_surface_closed(void *data,
@@ -198,6 +589,16 @@ static void layer_surface_closed(void *data,
     (void)surface;
     struct wlrsetroot_output *output = data;
     
+    resize_tiles(output, 0);
+    drop_view(output);
+    if (output->viewport) {
+        wp_viewport_destroy(output->viewport);
+        output->viewport = NULL;
+    }
+    if (output->fractional_scale) {
+        wp_fractional_scale_v1_destroy(output->fractional_scale);
+        output->fractional_scale = NULL;
+    }
     if (output->layer_surface) {
         zwlr_layer_surface_v1_destroy(output->layer_surface);
         output->layer_surface = NULL;
@@ -207,7 +608,11 @@ static void layer_surface_closed(void *data,
         output->surface = NULL;
     }
     
-    pool_buffer_destroy(&output->buffer);
+    shared_buffer_unref(output->buffer);
+    output->buffer = NULL;
+    release_previous(output);
+    output->configured = false;
+    output->configure_pending = false;
 }
 
 static const struct zwlr_layer_surface_v1_listener layer_surface_listener = {
@@ -215,6 +620,53 @@ static const struct zwlr_layer_surface_v1_listener layer_surface_listener = {
     .closed = layer_surface_closed,
 };
 
+static void surface_enter(void *data, struct wl_surface *surface,
+                          struct wl_output *wl_output) {
+    (void)data; (void)surface; (void)wl_output;
+}
+
+static void surface_leave(void *data, struct wl_surface *surface,
+                          struct wl_output *wl_output) {
+    (void)data; (void)surface; (void)wl_output;
+}
+
+static void surface_preferred_buffer_scale(void *data, struct wl_surface *surface,
+                                           int32_t factor) {
+    (void)surface;
+    struct wlrsetroot_output *output = data;
+    if (output->preferred_buffer_scale != factor) {
+        output->preferred_buffer_scale = factor;
+        output->dirty = true;
+    }
+}
+
+static void surface_preferred_buffer_transform(void *data, struct wl_surface *surface,
+                                               uint32_t transform) {
+    (void)data; (void)surface; (void)transform;
+}
+
+static const struct wl_surface_listener surface_listener = {
+    .enter = surface_enter,
+    .leave = surface_leave,
+    .preferred_buffer_scale = surface_preferred_buffer_scale,
+    .preferred_buffer_transform = surface_preferred_buffer_transform,
+};
+
+static void fractional_scale_preferred_scale(void *data,
+                                             struct wp_fractional_scale_v1 *fractional_scale,
+                                             uint32_t scale) {
+    (void)fractional_scale;
+    struct wlrsetroot_output *output = data;
+    if (output->preferred_scale != scale) {
+        output->preferred_scale = scale;
+        output->dirty = true;
+    }
+}
+
+static const struct wp_fractional_scale_v1_listener fractional_scale_listener = {
+    .preferred_scale = fractional_scale_preferred_scale,
+};
+
 // Create layer surface for an output
 static void create_layer_surface(struct wlrsetroot_output *output) {
     struct wlrsetroot_state *state = output->state;
@@ -224,11 +676,17 @@ static void create_layer_surface(struct wlrsetroot_output *output) {
         fprintf(stderr, "Failed to create surface\n");
         return;
     }
+    wl_surface_add_listener(output->surface, &surface_listener, output);
     
-    // Create empty input region (we don't want input events)
-    struct wl_region *input_region = wl_compositor_create_region(state->compositor);
-    wl_surface_set_input_region(output->surface, input_region);
-    wl_region_destroy(input_region);
+    // Preferred scales arrive before the first configure
+    if (state->fractional_scale) {
+        output->fractional_scale = wp_fractional_scale_manager_v1_get_fractional_scale(
+            state->fractional_scale, output->surface);
+        wp_fractional_scale_v1_add_listener(output->fractional_scale,
+                                            &fractional_scale_listener, output);
+    }
+    
+    set_surface_regions(state, output->surface);
     
     output->layer_surface = zwlr_layer_shell_v1_get_layer_surface(
         state->layer_shell,
@@ -254,51 +712,861 @@ static void create_layer_surface(struct wlrsetroot_output *output) {
         ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT);
     zwlr_layer_surface_v1_set_exclusive_zone(output->layer_surface, -1);
     
-    zwlr_layer_surface_v1_add_listener(output->layer_surface,
-                                       &layer_surface_listener, output);
+    zwlr_layer_surface_v1_add_listener(output->layer_surface,
+                                       &layer_surface_listener, output);
+    
+    // Initial commit to get configure event
+    wl_surface_commit(output->surface);
+}
+
+// Pick the cheapest buffer format the compositor supports
+// The wallpaper is always opaque, so XRGB8888 lets the compositor skip
+// blending; RGB565 halves memory and upload bandwidth when asked for.
+// Chosen when the first buffer is keyed. wl_shm sends its formats when it
+// is bound, but outputs bound ahead of it may be done first, so speculative
+// renders wait for the sync sent after binding. Configures answer layer
+// surfaces created after that sync, so they always come later
+static void choose_shm_format(struct wlrsetroot_state *state) {
+    state->format_chosen = true;
+    state->shm_format = WL_SHM_FORMAT_XRGB8888;
+    state->pixel_format = PIXEL_FORMAT_XRGB8888;
+    
+    if (state->rgb565) {
+        if (state->shm_rgb565) {
+            state->shm_format = WL_SHM_FORMAT_RGB565;
+            state->pixel_format = PIXEL_FORMAT_RGB565;
+        } else {
+            fprintf(stderr, "Compositor does not support RGB565, using XRGB8888\n");
+        }
+    }
+}
+
+// Describe the buffer an output needs; solid fills use one stretched pixel
+static void get_buffer_key(const struct wlrsetroot_output *output,
+                           struct buffer_key *key) {
+    struct wlrsetroot_state *state = output->state;
+    
+    if (!state->format_chosen) {
+        choose_shm_format(state);
+    }
+    get_render_params(state, &key->params);
+    key->format = state->shm_format;
+    if (use_solid_pixel(state)) {
+        key->width = 1;
+        key->height = 1;
+    } else if (use_fractional_scale(output)) {
+        // Rounded half away from zero, as the protocol specifies
+        key->width = (uint32_t)(((uint64_t)output->width * output->preferred_scale + 60) / 120);
+        key->height = (uint32_t)(((uint64_t)output->height * output->preferred_scale + 60) / 120);
+    } else {
+        int32_t scale = output_buffer_scale(output);
+        key->width = output->width * scale;
+        key->height = output->height * scale;
+        
+        // A tile of whole logical pixels that repeats across the output
+        uint32_t tile_width, tile_height;
+        if (use_tiles(output) &&
+            render_tile_size(&key->params, key->width, key->height, TILE_MIN_SIZE,
+                             (uint32_t)scale, &tile_width, &tile_height)) {
+            key->width = tile_width;
+            key->height = tile_height;
+        }
+    }
+}
+
+// Create the buffer for a one-pixel solid fill
+// Uses a single-pixel buffer when available, otherwise a 1x1 shm buffer
+static bool create_solid_pixel(struct wlrsetroot_state *state,
+                               struct shared_buffer *buf) {
+    uint32_t color = buf->key.params.bg;
+    
+    if (state->single_pixel) {
+        // Channels are 32-bit, so widen each 8-bit value
+        uint32_t r = ((color >> 16) & 0xFF) * 0x01010101u;
+        uint32_t g = ((color >> 8) & 0xFF) * 0x01010101u;
+        uint32_t b = (color & 0xFF) * 0x01010101u;
+        // Not shm, and never redrawn, so it lives outside the pool's arena
+        buf->buffer = &buf->pool.slots[0];
+        buf->buffer->buffer = wp_single_pixel_buffer_manager_v1_create_u32_rgba_buffer(
+            state->single_pixel, r, g, b, UINT32_MAX);
+        buf->buffer->width = 1;
+        buf->buffer->height = 1;
+        return buf->buffer->buffer != NULL;
+    }
+    
+    buf->buffer = buffer_pool_acquire(&buf->pool, 1, 1, buf->key.format);
+    if (!buf->buffer) {
+        return false;
+    }
+    uint32_t pixel = pixel_format_pack(buf->key.params.format, color);
+    if (pixel_format_bytes(buf->key.params.format) == 2) {
+        *(uint16_t *)buf->buffer->data = (uint16_t)pixel;
+    } else {
+        *(uint32_t *)buf->buffer->data = pixel;
+    }
+    return true;
+}
+
+// Split a rectangle of a buffer into bands, at most one per worker
+static bool add_render_rect(struct wlrsetroot_state *state, struct shared_buffer *buf,
+                            uint32_t x_begin, uint32_t x_end,
+                            uint32_t y_begin, uint32_t y_end) {
+    uint32_t rows = y_end - y_begin;
+    uint32_t count = (rows + MIN_BAND_ROWS - 1) / MIN_BAND_ROWS;
+    if (count > worker_pool_size(state->workers)) {
+        count = worker_pool_size(state->workers);
+    }
+    if (count == 0 || x_begin >= x_end) {
+        return true;
+    }
+    
+    struct render_band *bands = realloc(buf->bands,
+                                        (buf->band_count + count) * sizeof(*bands));
+    if (!bands) {
+        return false;
+    }
+    buf->bands = bands;
+    
+    for (uint32_t i = 0; i < count; i++) {
+        struct render_band *band = &bands[buf->band_count + i];
+        *band = (struct render_band){
+            .x_begin = x_begin,
+            .x_end = x_end,
+            .y_begin = y_begin + (uint32_t)((uint64_t)rows * i / count),
+            .y_end = y_begin + (uint32_t)((uint64_t)rows * (i + 1) / count),
+        };
+    }
+    buf->band_count += count;
+    return true;
+}
+
+// Whether a buffer is worth keeping in the on-disk cache
+// Not while -cycle is on, as its colors never come back exactly
+static bool use_render_cache(const struct wlrsetroot_state *state,
+                             const struct pool_buffer *slot) {
+    return state->render_cache && state->cycle_period == 0 &&
+           (size_t)slot->stride * slot->height >= RENDER_CACHE_MIN_SIZE;
+}
+
+// Fill a slot with the key's pixels from the on-disk cache
+// Returns false on a miss, leaving the slot to be rendered
+static bool load_cached(struct wlrsetroot_state *state, const struct buffer_key *key,
+                        struct pool_buffer *slot) {
+    if (!use_render_cache(state, slot)) {
+        return false;
+    }
+    
+    int fd = render_cache_lookup(state->render_cache, key, slot->stride);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = pool_buffer_read(slot, fd, RENDER_CACHE_DATA_OFFSET);
+    close(fd);
+    return ok;
+}
+
+// Write rendered buffers to the on-disk cache
+// Run after the commits are flushed, so the disk writes don't delay them
+static void store_rendered(struct wlrsetroot_state *state) {
+    struct shared_buffer *buf;
+    wl_list_for_each(buf, &state->buffers.buffers, link) {
+        if (buf->cache_store && buf->rendered && !buf->bands) {
+            buf->cache_store = false;
+            render_cache_store(state->render_cache, &buf->key,
+                               buf->buffer->stride, buf->buffer->data);
+        }
+    }
+}
+
+// Acquire a free slot for a shared buffer's key and plan its render
+// A buffer found in the on-disk cache is loaded instead and needs no render
+static bool start_render(struct wlrsetroot_state *state, struct shared_buffer *buf) {
+    const struct buffer_key *key = &buf->key;
+    
+    if (key->width == 1 && key->height == 1 && use_solid_pixel(state)) {
+        buf->rendered = create_solid_pixel(state, buf);
+        return buf->rendered;
+    }
+    
+    struct pool_buffer *slot = buffer_pool_acquire(&buf->pool, key->width,
+                                                   key->height, key->format);
+    if (!slot) {
+        return false;
+    }
+    
+    // A kept mask turns a color change into a recolor pass
+    bool recolor = buf->mask &&
+                   render_mask_matches(buf->mask, &key->params, key->width, key->height);
+    if (!recolor) {
+        render_mask_destroy(buf->mask);
+        buf->mask = NULL;
+    }
+    
+    if (!recolor && load_cached(state, key, slot)) {
+        buf->buffer = slot;
+        buf->rendered = true;
+        buf->cache_store = false;
+        return true;
+    }
+    
+    buf->plan = render_plan_create(&key->params, key->width, key->height);
+    if (!buf->plan || !add_render_rect(state, buf, 0, key->width, 0, key->height)) {
+        render_plan_destroy(buf->plan);
+        buf->plan = NULL;
+        return false;
+    }
+    for (uint32_t i = 0; recolor && i < buf->band_count; i++) {
+        buf->bands[i].mask = buf->mask;
+    }
+    
+    buf->buffer = slot;
+    buf->rendered = false;
+    buf->cache_store = use_render_cache(state, slot);
+    return true;
+}
+
+// Move a buffer whose new size doesn't fit its slot into another slot of
+// its pool, copying over the pixels inside both sizes. The old slot keeps
+// its wl_buffer and is left to the compositor until released
+static bool move_to_slot(struct shared_buffer *buf, const struct buffer_key *key) {
+    struct pool_buffer *old = buf->buffer;
+    
+    // Marked busy meanwhile, so the pool can't reallocate the old slot
+    // while its pixels are still needed
+    bool busy = old->busy;
+    old->busy = true;
+    struct pool_buffer *slot = buffer_pool_acquire(&buf->pool, key->width,
+                                                   key->height, key->format);
+    old->busy = busy;
+    if (!slot) {
+        return false;
+    }
+    
+    // Read after acquiring, as growing the arena may have moved old->data
+    uint32_t rows = old->height < key->height ? old->height : key->height;
+    uint32_t columns = old->width < key->width ? old->width : key->width;
+    size_t bytes = (size_t)columns * pixel_format_bytes(key->params.format);
+    for (uint32_t y = 0; y < rows; y++) {
+        memcpy((uint8_t *)slot->data + (size_t)y * slot->stride,
+               (const uint8_t *)old->data + (size_t)y * old->stride, bytes);
+    }
+    buf->buffer = slot;
+    return true;
+}
+
+// Reuse an unshared buffer for a new size of the same pattern
+// The pattern is anchored at the buffer origin, so pixels inside both the
+// old and new sizes stay valid; only the newly exposed columns to the right
+// and rows below are rendered. A size that fits the slot's memory and
+// stride reshapes it in place: the exposed pixels lie outside the old
+// wl_buffer, which the compositor may still be reading, and it is kept
+// until the commit. A wider, rotated or much taller size moves to another
+// slot with the valid pixels copied over. Returns false, for a full
+// render, if no slot is free
+static bool reshape_render(struct wlrsetroot_state *state, struct wlrsetroot_output *output,
+                           const struct buffer_key *key) {
+    struct shared_buffer *buf = output->buffer;
+    
+    // Only the size may differ
+    struct buffer_key resized = buf->key;
+    resized.width = key->width;
+    resized.height = key->height;
+    if (buf->refs != 1 || !buf->rendered || !buffer_key_equal(&resized, key)) {
+        return false;
+    }
+    
+    uint32_t old_width = buf->key.width;
+    uint32_t old_height = buf->key.height;
+    struct wl_buffer *old_buffer = buf->buffer->buffer;
+    if (pool_buffer_reshape(buf->buffer, key->width, key->height, key->format)) {
+        output->stale_buffer = old_buffer;
+    } else if (!move_to_slot(buf, key)) {
+        return false;
+    }
+    buf->key = *key;
+    
+    uint32_t kept_height = old_height < key->height ? old_height : key->height;
+    if (old_width >= key->width && old_height >= key->height) {
+        return true;
+    }
+    
+    buf->plan = render_plan_create(&key->params, key->width, key->height);
+    bool ok = buf->plan != NULL;
+    if (ok && old_width < key->width) {
+        ok = add_render_rect(state, buf, old_width, key->width, 0, kept_height);
+    }
+    if (ok && old_height < key->height) {
+        ok = add_render_rect(state, buf, 0, key->width, old_height, key->height);
+    }
+    buf->rendered = false;
+    buf->cache_store = use_render_cache(state, buf->buffer);
+    if (!ok) {
+        // Left unrendered, so the output reports the failure and drops it
+        free(buf->bands);
+        buf->bands = NULL;
+        buf->band_count = 0;
+        render_plan_destroy(buf->plan);
+        buf->plan = NULL;
+    }
+    return true;
+}
+
+// Whether key differs from a buffer's key in nothing but the colors
+static bool recolors(const struct shared_buffer *buf, const struct buffer_key *key) {
+    struct buffer_key recolored = buf->key;
+    recolored.params.fg = key->params.fg;
+    recolored.params.bg = key->params.bg;
+    return buffer_key_equal(&recolored, key);
+}
+
+// Hand the coverage mask of from's pattern to the buffer replacing it when
+// only the colors change, taking the mask on the first such change
+// The mask then moves along with the output, so further color changes and
+// -cycle steps recolor instead of rendering. Without a mask, as for box
+// filtered patterns, the new buffer is rendered as usual
+static void carry_mask(struct shared_buffer *from, struct shared_buffer *to,
+                       const struct buffer_key *key) {
+    if (!from || !recolors(from, key)) {
+        return;
+    }
+    if (!from->mask || !render_mask_matches(from->mask, &from->key.params,
+                                            from->key.width, from->key.height)) {
+        render_mask_destroy(from->mask);
+        from->mask = render_mask_create(&from->key.params, from->key.width,
+                                        from->key.height);
+    }
+    if (from != to) {
+        render_mask_destroy(to->mask);
+        to->mask = from->mask;
+        from->mask = NULL;
+    }
+}
+
+// Queue a started render's bands on the worker pool
+// Only called once every buffer of the batch is allocated, since growing
+// the shm arena may move the mapping
+static void queue_render(struct wlrsetroot_state *state, struct shared_buffer *buf) {
+    for (uint32_t i = 0; i < buf->band_count; i++) {
+        struct render_band *band = &buf->bands[i];
+        band->plan = buf->plan;
+        band->data = buf->buffer->data;
+        band->stride = buf->buffer->stride;
+        worker_pool_submit(state->workers, render_band_run, band);
+    }
+}
+
+// Collect the bands of a finished render
+static void finish_render(struct shared_buffer *buf) {
+    bool ok = true;
+    for (uint32_t i = 0; i < buf->band_count; i++) {
+        ok = ok && buf->bands[i].ok;
+    }
+    
+    free(buf->bands);
+    buf->bands = NULL;
+    buf->band_count = 0;
+    render_plan_destroy(buf->plan);
+    buf->plan = NULL;
+    
+    buf->rendered = ok;
+}
+
+// Wait for queued renders and collect their results
+static void wait_renders(struct wlrsetroot_state *state) {
+    worker_pool_wait(state->workers);
+    
+    struct shared_buffer *buf;
+    wl_list_for_each(buf, &state->buffers.buffers, link) {
+        if (buf->bands) {
+            finish_render(buf);
+        }
+    }
+}
+
+// Whether a configured output may need a new buffer
+static bool output_needs_render(const struct wlrsetroot_output *output) {
+    return output->configured && output->dirty &&
+           output->width != 0 && output->height != 0;
+}
+
+// Ack the configure the next commit answers
+static void ack_output_configure(struct wlrsetroot_output *output) {
+    if (output->configure_pending) {
+        zwlr_layer_surface_v1_ack_configure(output->layer_surface,
+                                            output->configure_serial);
+        output->configure_pending = false;
+    }
+}
+
+// Show a tile buffer across the whole output
+// The layer surface is the top left cell and synchronized subsurfaces the
+// others, all attached to the same wl_buffer. Cells at the right and
+// bottom edges are cropped to the output by their viewports
+static void present_tiles(struct wlrsetroot_output *output, struct pool_buffer *buffer) {
+    struct wlrsetroot_state *state = output->state;
+    int32_t scale = output_buffer_scale(output);
+    uint32_t cell_width = buffer->width / (uint32_t)scale;
+    uint32_t cell_height = buffer->height / (uint32_t)scale;
+    uint32_t columns = (output->width + cell_width - 1) / cell_width;
+    uint32_t rows = (output->height + cell_height - 1) / cell_height;
+    
+    if (!resize_tiles(output, columns * rows - 1)) {
+        fprintf(stderr, "Failed to create tile surfaces\n");
+    }
+    
+    for (uint32_t i = 0; i < output->tile_count; i++) {
+        struct output_tile *tile = &output->tiles[i];
+        uint32_t x = (i + 1) % columns * cell_width;
+        uint32_t y = (i + 1) / columns * cell_height;
+        uint32_t width = output->width - x < cell_width ? output->width - x : cell_width;
+        uint32_t height = output->height - y < cell_height ? output->height - y : cell_height;
+        
+        wl_subsurface_set_position(tile->subsurface, (int32_t)x, (int32_t)y);
+        if ((width < cell_width || height < cell_height) && !tile->viewport) {
+            tile->viewport = wp_viewporter_get_viewport(state->viewporter, tile->surface);
+        }
+        if (tile->viewport) {
+            bool crop = width < cell_width || height < cell_height;
+            wp_viewport_set_source(tile->viewport,
+                                   wl_fixed_from_int(crop ? 0 : -1),
+                                   wl_fixed_from_int(crop ? 0 : -1),
+                                   wl_fixed_from_int(crop ? (int)width : -1),
+                                   wl_fixed_from_int(crop ? (int)height : -1));
+        }
+        wl_surface_set_buffer_scale(tile->surface, scale);
+        pool_buffer_attach(buffer, tile->surface);
+        wl_surface_damage_buffer(tile->surface, 0, 0, buffer->width, buffer->height);
+        wl_surface_commit(tile->surface);
+    }
+}
+
+// Attach the output's buffer: ack any pending configure, attach and commit
+static void present_output(struct wlrsetroot_output *output) {
+    struct pool_buffer *buffer = output->buffer->buffer;
+    
+    ack_output_configure(output);
+    
+    if (use_solid_pixel(output->state) || use_fractional_scale(output)) {
+        if (!output->viewport) {
+            output->viewport = wp_viewporter_get_viewport(
+                output->state->viewporter, output->surface);
+        }
+        wp_viewport_set_destination(output->viewport, output->width, output->height);
+        wl_surface_set_buffer_scale(output->surface, 1);
+    } else {
+        if (output->viewport) {
+            wp_viewport_set_destination(output->viewport, -1, -1);
+        }
+        wl_surface_set_buffer_scale(output->surface, output_buffer_scale(output));
+    }
+    
+    pool_buffer_attach(buffer, output->surface);
+    wl_surface_damage_buffer(output->surface, 0, 0, buffer->width, buffer->height);
+    if (use_tiles(output)) {
+        present_tiles(output, buffer);
+    }
+    wl_surface_commit(output->surface);
+    
+    // Cells of a tiled buffer, or a canvas view, the output no longer uses
+    if (!use_tiles(output)) {
+        resize_tiles(output, 0);
+    }
+    drop_view(output);
+    
+    // The compositor no longer needs what the surface showed before
+    release_previous(output);
+}
+
+// Whether the global rectangles of two outputs intersect
+static bool outputs_overlap(const struct wlrsetroot_output *a,
+                            const struct wlrsetroot_output *b) {
+    return a->x < b->x + (int64_t)b->width && b->x < a->x + (int64_t)a->width &&
+           a->y < b->y + (int64_t)b->height && b->y < a->y + (int64_t)a->height;
+}
+
+// Whether an output's view still matches the canvas layout
+static bool view_current(const struct wlrsetroot_output *output) {
+    return output->view && output->view_x == output->x && output->view_y == output->y &&
+           output->view_width == output->width && output->view_height == output->height;
+}
+
+// Show the output's view of the canvas
+static void present_view(struct wlrsetroot_output *output, int32_t scale) {
+    ack_output_configure(output);
+    if (output->viewport) {
+        wp_viewport_set_destination(output->viewport, -1, -1);
+    }
+    wl_surface_set_buffer_scale(output->surface, scale);
+    pool_buffer_view_attach(output->view, output->surface);
+    wl_surface_damage_buffer(output->surface, 0, 0, INT32_MAX, INT32_MAX);
+    wl_surface_commit(output->surface);
+    
+    // A buffer of its own from before -span applied, such as a solid fill
+    if (output->buffer) {
+        shared_buffer_unref(output->retired);
+        output->retired = output->buffer;
+        output->buffer = NULL;
+    }
+    release_previous(output);
+}
+
+// Give an output a view of its rectangle of the freshly rendered canvas
+static bool update_view(struct wlrsetroot_state *state, struct wlrsetroot_output *output) {
+    int32_t scale = state->canvas_scale;
+    struct pool_buffer_view *view = calloc(1, sizeof(*view));
+    if (!view || !pool_buffer_view_create(view, state->canvas->buffer,
+                                          (uint32_t)(output->x - state->canvas_x) * scale,
+                                          (uint32_t)(output->y - state->canvas_y) * scale,
+                                          output->width * scale, output->height * scale)) {
+        free(view);
+        return false;
+    }
+    
+    // The old view is replaced in the same commit
+    struct pool_buffer_view *old = output->view;
+    output->view = view;
+    output->view_x = output->x;
+    output->view_y = output->y;
+    output->view_width = output->width;
+    output->view_height = output->height;
+    present_view(output, scale);
+    if (old) {
+        pool_buffer_view_destroy(old);
+        free(old);
+    }
+    return true;
+}
+
+// Render the -span canvas and show every output its part of it
+// The canvas covers the bounding box of the outputs in the global
+// compositor space at the largest output scale, so the pattern lines up
+// across heads. Only the outputs' rectangles are rendered, each pixel
+// once, unless outputs overlap. Every output's wl_buffer is a view into
+// the canvas at its offset with the canvas stride, so nothing is copied
+static void render_span(struct wlrsetroot_state *state) {
+    bool pending = false;
+    struct wlrsetroot_output *output;
+    wl_list_for_each(output, &state->outputs, link) {
+        // Each output changes the layout, so wait for all of their sizes
+        if (output->layer_surface && !output->configured) {
+            return;
+        }
+        pending = pending || output_needs_render(output);
+    }
+    if (!pending) {
+        return;
+    }
+    
+    int64_t x0 = INT64_MAX, y0 = INT64_MAX, x1 = INT64_MIN, y1 = INT64_MIN;
+    int32_t scale = 1;
+    bool overlap = false;
+    wl_list_for_each(output, &state->outputs, link) {
+        if (!output->configured || output->width == 0 || output->height == 0) {
+            continue;
+        }
+        struct wlrsetroot_output *other;
+        wl_list_for_each(other, &state->outputs, link) {
+            if (other == output) {
+                break;
+            }
+            overlap = overlap || (other->configured && outputs_overlap(output, other));
+        }
+        x0 = output->x < x0 ? output->x : x0;
+        y0 = output->y < y0 ? output->y : y0;
+        x1 = output->x + (int64_t)output->width > x1 ? output->x + (int64_t)output->width : x1;
+        y1 = output->y + (int64_t)output->height > y1 ? output->y + (int64_t)output->height : y1;
+        scale = output_buffer_scale(output) > scale ? output_buffer_scale(output) : scale;
+    }
+    
+    if (!state->format_chosen) {
+        choose_shm_format(state);
+    }
+    struct buffer_key key;
+    get_render_params(state, &key.params);
+    key.format = state->shm_format;
+    if ((x1 - x0) * scale > MAX_CANVAS_SIZE || (y1 - y0) * scale > MAX_CANVAS_SIZE) {
+        fprintf(stderr, "Output layout too large for -span\n");
+        wl_list_for_each(output, &state->outputs, link) {
+            output->dirty = false;
+        }
+        return;
+    }
+    key.width = (uint32_t)((x1 - x0) * scale);
+    key.height = (uint32_t)((y1 - y0) * scale);
+    
+    // Same layout and contents: only answer configures
+    bool same = state->canvas && state->canvas->rendered &&
+                buffer_key_equal(&state->canvas->key, &key) &&
+                state->canvas_x == x0 && state->canvas_y == y0 &&
+                state->canvas_scale == scale;
+    wl_list_for_each(output, &state->outputs, link) {
+        if (output_needs_render(output)) {
+            same = same && view_current(output);
+        }
+    }
+    if (same) {
+        wl_list_for_each(output, &state->outputs, link) {
+            if (output_needs_render(output)) {
+                output->dirty = false;
+                if (output->configure_pending) {
+                    present_view(output, scale);
+                }
+            }
+        }
+        return;
+    }
+    
+    // Speculative renders finish before the arena may grow
+    wait_renders(state);
+    if (!state->canvas) {
+        state->canvas = buffer_cache_add(&state->buffers, &key, state->arena);
+        if (!state->canvas) {
+            fprintf(stderr, "Failed to create buffer\n");
+            return;
+        }
+    }
+    struct shared_buffer *canvas = state->canvas;
+    
+    // The views on screen keep their slot busy; retried after a release
+    if (buffer_pool_busy_count(&canvas->pool) == BUFFER_POOL_SLOTS) {
+        return;
+    }
+    
+    canvas->key = key;
+    canvas->buffer = buffer_pool_acquire(&canvas->pool, key.width, key.height, key.format);
+    canvas->plan = render_plan_create(&key.params, key.width, key.height);
+    canvas->rendered = false;
+    bool ok = canvas->buffer && canvas->plan;
+    if (ok && overlap) {
+        ok = add_render_rect(state, canvas, 0, key.width, 0, key.height);
+    }
+    wl_list_for_each(output, &state->outputs, link) {
+        if (ok && !overlap && output->configured && output->width != 0 && output->height != 0) {
+            uint32_t x = (uint32_t)(output->x - x0) * scale;
+            uint32_t y = (uint32_t)(output->y - y0) * scale;
+            ok = add_render_rect(state, canvas, x, x + output->width * scale,
+                                 y, y + output->height * scale);
+        }
+    }
+    if (ok) {
+        queue_render(state, canvas);
+    }
+    wait_renders(state);
+    render_plan_destroy(canvas->plan);  // left over if no band was queued
+    canvas->plan = NULL;
+    
+    state->canvas_x = (int32_t)x0;
+    state->canvas_y = (int32_t)y0;
+    state->canvas_scale = scale;
+    wl_list_for_each(output, &state->outputs, link) {
+        if (!output->configured || output->width == 0 || output->height == 0) {
+            continue;
+        }
+        output->dirty = false;
+        if (!ok || !canvas->rendered || !update_view(state, output)) {
+            fprintf(stderr, "Failed to render pattern\n");
+        }
+    }
+}
+
+// Render every configured output whose size or scale changed
+// Outputs with identical buffers share one render. Distinct buffers and
+// their bands render in parallel, then all outputs are committed together
+// so every head shows the wallpaper at the same time. A reconfigure to the
+// same buffer size is only acked; a new size reuses the output's own buffer
+// when nothing else shares it and it fits
+static void render_pending_outputs(struct wlrsetroot_state *state) {
+    if (use_span(state)) {
+        render_span(state);
+        return;
+    }
+    
+    bool pending = false;
+    
+    struct wlrsetroot_output *output;
+    wl_list_for_each(output, &state->outputs, link) {
+        pending = pending || output_needs_render(output);
+    }
+    if (!pending) {
+        return;
+    }
+    pending = false;
+    
+    // Speculative renders finish before any buffer is allocated or reused
+    wait_renders(state);
+    
+    // -low-rss unmapped the arena after the last commit; reshaped buffers
+    // are drawn into without being acquired, so it is mapped up front
+    if (!shm_arena_map(state->arena)) {
+        return;  // the outputs stay dirty and are retried
+    }
+    
+    wl_list_for_each(output, &state->outputs, link) {
+        if (!output_needs_render(output)) {
+            continue;
+        }
+        output->dirty = false;
+        
+        struct buffer_key key;
+        get_buffer_key(output, &key);
+        if (output->buffer) {
+            bool unchanged = buffer_key_equal(&output->buffer->key, &key);
+            if (unchanged || reshape_render(state, output, &key)) {
+                output->needs_commit = output->configure_pending ||
+                                       output->stale_buffer || !unchanged;
+                pending = pending || output->needs_commit;
+                continue;
+            }
+        }
+        
+        struct shared_buffer *match = buffer_cache_find(&state->buffers, &key);
+        struct shared_buffer *own = output->buffer;
+        if (own && !match && own->refs == 1 && !use_solid_pixel(state)) {
+            // Redraw into another slot of the same pool; the one on screen
+            // stays untouched until the compositor releases it
+            if (buffer_pool_busy_count(&own->pool) == BUFFER_POOL_SLOTS) {
+                output->dirty = true;  // retried after a release event
+                continue;
+            }
+            carry_mask(own, own, &key);
+            own->key = key;
+            if (!start_render(state, own)) {
+                fprintf(stderr, "Failed to create buffer\n");
+                shared_buffer_unref(own);
+                output->buffer = NULL;
+                continue;
+            }
+            output->needs_commit = true;
+            pending = true;
+            continue;
+        }
+        
+        output->retired = own;
+        output->buffer = match;
+        if (!output->buffer) {
+            output->buffer = buffer_cache_add(&state->buffers, &key, state->arena);
+            if (!output->buffer) {
+                fprintf(stderr, "Failed to create buffer\n");
+                release_previous(output);
+                continue;
+            }
+            carry_mask(own, output->buffer, &key);
+            if (!start_render(state, output->buffer)) {
+                fprintf(stderr, "Failed to create buffer\n");
+                shared_buffer_unref(output->buffer);
+                output->buffer = NULL;
+                release_previous(output);
+                continue;
+            }
+        }
+        output->needs_commit = true;
+        pending = true;
+    }
+    
+    // A configured output found its speculative buffer in the cache if the
+    // guess was right; otherwise the guess is dropped here
+    wl_list_for_each(output, &state->outputs, link) {
+        if (output->configured && output->speculative) {
+            shared_buffer_unref(output->speculative);
+            output->speculative = NULL;
+        }
+    }
+    
+    if (!pending) {
+        return;
+    }
+    
+    struct shared_buffer *buf;
+    wl_list_for_each(buf, &state->buffers.buffers, link) {
+        if (buf->bands) {
+            queue_render(state, buf);
+        }
+    }
+    
+    wait_renders(state);
+    
+    wl_list_for_each(output, &state->outputs, link) {
+        if (!output->needs_commit) {
+            continue;
+        }
+        output->needs_commit = false;
+        
+        if (!output->buffer->rendered) {
+            fprintf(stderr, "Failed to render pattern\n");
+            shared_buffer_unref(output->buffer);
+            output->buffer = NULL;
+            release_previous(output);
+            continue;
+        }
+        present_output(output);
+    }
+    
+    // The canvas of -span, now that no output shows it
+    if (state->canvas) {
+        shared_buffer_unref(state->canvas);
+        state->canvas = NULL;
+    }
     
-    // Initial commit to get configure event
-    wl_surface_commit(output->surface);
+    if (state->render_cache) {
+        wl_display_flush(state->display);
+        store_rendered(state);
+    }
 }
 
-// Render and display the wallpaper on an output
-static void render_output(struct wlrsetroot_output *output) {
+// Start rendering at the output's current mode before it is configured
+// A background layer surface anchored to all edges normally covers the
+// whole mode, so the buffer is usually ready when the configure arrives.
+// Left running on the worker pool while events are dispatched
+static void speculate_render(struct wlrsetroot_output *output) {
     struct wlrsetroot_state *state = output->state;
     
-    if (!output->configured || output->width == 0 || output->height == 0) {
+    // Tiles are small and depend on the configured size, and the -span
+    // canvas on the whole layout
+    // Keying a buffer fixes the shm format, which needs wl_shm's formats
+    if (output->configured || output->speculative || use_solid_pixel(state) ||
+        state->tile || state->span || !state->formats_known ||
+        output->mode_width <= 0 || output->mode_height <= 0) {
         return;
     }
     
-    uint32_t buffer_width = output->width * output->scale;
-    uint32_t buffer_height = output->height * output->scale;
+    struct buffer_key key;
+    get_buffer_key(output, &key);
+    bool rotated = output->transform & 1;  // 90 and 270 degrees, flipped or not
+    key.width = (uint32_t)(rotated ? output->mode_height : output->mode_width);
+    key.height = (uint32_t)(rotated ? output->mode_width : output->mode_height);
     
-    // Create buffer if needed
-    if (output->buffer.buffer == NULL ||
-        output->buffer.width != buffer_width ||
-        output->buffer.height != buffer_height) {
-        
-        pool_buffer_destroy(&output->buffer);
-        
-        if (!pool_buffer_create(&output->buffer, state->shm,
-                                buffer_width, buffer_height,
-                                WL_SHM_FORMAT_ARGB8888)) {
-            fprintf(stderr, "Failed to create buffer\n");
+    // Growing the arena moves buffers other renders may be writing
+    wait_renders(state);
+    
+    struct shared_buffer *buf = buffer_cache_find(&state->buffers, &key);
+    if (!buf) {
+        buf = buffer_cache_add(&state->buffers, &key, state->arena);
+        if (!buf) {
+            return;
+        }
+        if (!start_render(state, buf)) {
+            shared_buffer_unref(buf);
             return;
         }
+        queue_render(state, buf);
+    }
+    output->speculative = buf;
+}
+
+// Create the layer surface of an output once its properties are known
+static void setup_output(struct wlrsetroot_output *output) {
+    if (output->layer_surface) {
+        return;
     }
     
-    // Render the pattern
-    render_tiled_pattern(output);
-    
-    // Ack configure
-    zwlr_layer_surface_v1_ack_configure(output->layer_surface,
-                                        output->configure_serial);
+    create_layer_surface(output);
+    if (!output->layer_surface) {
+        return;
+    }
     
-    // Attach and commit
-    wl_surface_set_buffer_scale(output->surface, output->scale);
-    wl_surface_attach(output->surface, output->buffer.buffer, 0, 0);
-    wl_surface_damage_buffer(output->surface, 0, 0, buffer_width, buffer_height);
-    wl_surface_commit(output->surface);
+    // Let the compositor work on the configure while we render
+    wl_display_flush(output->state->display);
+    speculate_render(output);
 }
 
 // Output event handlers
@@ -307,31 +1575,49 @@ static void output_geometry(void *data, struct wl_output *wl_output,
                            int32_t physical_height, int32_t subpixel,
                            const char *make, const char *model,
                            int32_t transform) {
-    (void)data; (void)wl_output; (void)x; (void)y;
+    (void)wl_output;
     (void)physical_width; (void)physical_height; (void)subpixel;
-    (void)make; (void)model; (void)transform;
+    (void)make; (void)model;
+    struct wlrsetroot_output *output = data;
+    output->transform = transform;
+    
+    // Only -span uses the position; its canvas is laid out again
+    if (output->x != x || output->y != y) {
+        output->x = x;
+        output->y = y;
+        output->dirty = true;
+    }
 }
 
 static void output_mode(void *data, struct wl_output *wl_output,
                        uint32_t flags, int32_t width, int32_t height,
                        int32_t refresh) {
-    (void)data; (void)wl_output; (void)flags;
-    (void)width; (void)height; (void)refresh;
+    (void)wl_output; (void)refresh;
+    struct wlrsetroot_output *output = data;
+    
+    if (flags & WL_OUTPUT_MODE_CURRENT) {
+        output->mode_width = width;
+        output->mode_height = height;
+    }
 }
 
 static void output_done(void *data, struct wl_output *wl_output) {
     (void)wl_output;
     struct wlrsetroot_output *output = data;
     
-    if (!output->layer_surface) {
-        create_layer_surface(output);
+    output->done = true;
+    if (output->state->ready) {
+        setup_output(output);
     }
 }
 
 static void output_scale(void *data, struct wl_output *wl_output, int32_t scale) {
     (void)wl_output;
     struct wlrsetroot_output *output = data;
-    output->scale = scale;
+    if (output->scale != scale) {
+        output->scale = scale;
+        output->dirty = true;
+    }
 }
 
 static void output_name(void *data, struct wl_output *wl_output, const char *name) {
@@ -355,6 +1641,19 @@ static const struct wl_output_listener output_listener = {
 static void destroy_output(struct wlrsetroot_output *output) {
     wl_list_remove(&output->link);
     
+    if (output->speculative) {
+        wait_renders(output->state);
+        shared_buffer_unref(output->speculative);
+    }
+    
+    resize_tiles(output, 0);
+    drop_view(output);
+    if (output->viewport) {
+        wp_viewport_destroy(output->viewport);
+    }
+    if (output->fractional_scale) {
+        wp_fractional_scale_v1_destroy(output->fractional_scale);
+    }
     if (output->layer_surface) {
         zwlr_layer_surface_v1_destroy(output->layer_surface);
     }
@@ -365,23 +1664,65 @@ static void destroy_output(struct wlrsetroot_output *output) {
         wl_output_destroy(output->wl_output);
     }
     
-    pool_buffer_destroy(&output->buffer);
+    shared_buffer_unref(output->buffer);
+    release_previous(output);
     free(output);
 }
 
+// Record the formats we could use besides the mandatory 8888 ones
+static void shm_format(void *data, struct wl_shm *shm, uint32_t format) {
+    (void)shm;
+    struct wlrsetroot_state *state = data;
+    
+    if (format == WL_SHM_FORMAT_RGB565) {
+        state->shm_rgb565 = true;
+    }
+}
+
+static const struct wl_shm_listener shm_listener = {
+    .format = shm_format,
+};
+
+// wl_shm has sent its formats, which follow the bind ahead of this sync
+// Outputs set up in the meantime start their speculative render now
+static void shm_sync_done(void *data, struct wl_callback *callback, uint32_t serial) {
+    (void)serial;
+    struct wlrsetroot_state *state = data;
+    
+    wl_callback_destroy(callback);
+    state->shm_sync = NULL;
+    state->formats_known = true;
+    
+    struct wlrsetroot_output *output;
+    wl_list_for_each(output, &state->outputs, link) {
+        if (output->layer_surface) {
+            speculate_render(output);
+        }
+    }
+}
+
+static const struct wl_callback_listener shm_sync_listener = {
+    .done = shm_sync_done,
+};
+
 // Registry handlers
 static void registry_global(void *data, struct wl_registry *registry,
                            uint32_t name, const char *interface,
                            uint32_t version) {
-    (void)version;
     struct wlrsetroot_state *state = data;
     
     if (strcmp(interface, wl_compositor_interface.name) == 0) {
+        // Version 6 sends the preferred buffer scale
         state->compositor = wl_registry_bind(registry, name,
-                                             &wl_compositor_interface, 4);
+                                             &wl_compositor_interface,
+                                             version >= 6 ? 6 : 4);
+    } else if (strcmp(interface, wl_subcompositor_interface.name) == 0) {
+        state->subcompositor = wl_registry_bind(registry, name,
+                                                &wl_subcompositor_interface, 1);
     } else if (strcmp(interface, wl_shm_interface.name) == 0) {
         state->shm = wl_registry_bind(registry, name,
                                       &wl_shm_interface, 1);
+        wl_shm_add_listener(state->shm, &shm_listener, state);
     } else if (strcmp(interface, wl_output_interface.name) == 0) {
         struct wlrsetroot_output *output = calloc(1, sizeof(*output));
         if (!output) {
@@ -400,6 +1741,15 @@ static void registry_global(void *data, struct wl_registry *registry,
     } else if (strcmp(interface, zwlr_layer_shell_v1_interface.name) == 0) {
         state->layer_shell = wl_registry_bind(registry, name,
                                               &zwlr_layer_shell_v1_interface, 1);
+    } else if (strcmp(interface, wp_viewporter_interface.name) == 0) {
+        state->viewporter = wl_registry_bind(registry, name,
+                                             &wp_viewporter_interface, 1);
+    } else if (strcmp(interface, wp_single_pixel_buffer_manager_v1_interface.name) == 0) {
+        state->single_pixel = wl_registry_bind(registry, name,
+            &wp_single_pixel_buffer_manager_v1_interface, 1);
+    } else if (strcmp(interface, wp_fractional_scale_manager_v1_interface.name) == 0) {
+        state->fractional_scale = wl_registry_bind(registry, name,
+            &wp_fractional_scale_manager_v1_interface, 1);
     }
 }
 
@@ -422,11 +1772,374 @@ static const struct wl_registry_listener registry_listener = {
     .global_remove = registry_global_remove,
 };
 
+// Set by SIGINT and SIGTERM in -daemon mode
+static volatile sig_atomic_t quit_requested;
+
+static void handle_quit_signal(int sig) {
+    (void)sig;
+    quit_requested = 1;
+}
+
+// Milliseconds elapsed since start
+static double elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Whether two pattern tiles have the same bits
+static bool same_tile(const struct xbm_image *a, const struct xbm_image *b) {
+    if (!a || !b) {
+        return a == b;
+    }
+    return a->width == b->width && a->height == b->height &&
+           a->msb_first == b->msb_first &&
+           memcmp(a->bits, b->bits, (size_t)(a->width + 7) / 8 * a->height) == 0;
+}
+
+// Keep a replaced pattern tile until no buffer key refers to it
+// Keys compare tiles by address, so freeing one early could let a new
+// tile allocated at the same address match buffers of the old one
+static void retire_image(struct wlrsetroot_state *state, struct xbm_image *xbm) {
+    if (!xbm) {
+        return;
+    }
+    struct xbm_image **images = realloc(state->old_images,
+                                        (state->old_image_count + 1) * sizeof(*images));
+    if (!images) {
+        return;  // leaked, which is safe
+    }
+    state->old_images = images;
+    state->old_images[state->old_image_count++] = xbm;
+}
+
+// Free replaced tiles once their last buffer is gone
+static void free_old_images(struct wlrsetroot_state *state) {
+    size_t kept = 0;
+    for (size_t i = 0; i < state->old_image_count; i++) {
+        struct xbm_image *xbm = state->old_images[i];
+        bool used = false;
+        
+        struct shared_buffer *buf;
+        wl_list_for_each(buf, &state->buffers.buffers, link) {
+            used = used || buf->key.params.image == xbm;
+        }
+        if (used) {
+            state->old_images[kept++] = xbm;
+        } else {
+            xbm_free(xbm);
+        }
+    }
+    state->old_image_count = kept;
+}
+
+// Apply a control command on top of the current options
+// A new pattern tile is only used if its bits differ, and outputs whose
+// buffer key ends up unchanged are left alone by render_pending_outputs()
+static bool apply_command(struct wlrsetroot_state *state, int argc, char *argv[],
+                          const char **error) {
+    struct pattern_options options = state->options;
+    int excl = 0;
+    
+    for (int i = 0; i < argc; i++) {
+        int parsed = parse_pattern_option(&options, &excl, true, argc, argv, &i);
+        if (parsed <= 0) {
+            *error = parsed == 0 ? "unknown option" : "invalid option";
+            return false;
+        }
+    }
+    if (excl > 1) {
+        *error = "choose only one of {-bitmap, -builtin, -gray, -mod, -pbm, -solid}";
+        return false;
+    }
+    
+    // The file name points into the command, which is gone after this
+    struct xbm_image *xbm = state->xbm;
+    if (excl > 0) {
+        bool ok;
+        struct xbm_image *loaded = build_pattern(&options, &ok);
+        if (!ok) {
+            *error = "failed to load pattern";
+            return false;
+        }
+        if (same_tile(loaded, xbm)) {
+            xbm_free(loaded);
+        } else {
+            retire_image(state, xbm);
+            xbm = loaded;
+        }
+    }
+    options.pattern_file = NULL;
+    
+    state->options = options;
+    state->xbm = xbm;
+    
+    struct wlrsetroot_output *output;
+    wl_list_for_each(output, &state->outputs, link) {
+        output->dirty = true;
+    }
+    return true;
+}
+
+static void control_sync_done(void *data, struct wl_callback *callback,
+                              uint32_t serial) {
+    (void)serial;
+    struct wlrsetroot_state *state = data;
+    
+    wl_callback_destroy(callback);
+    state->control_sync = NULL;
+    control_reply(state->control_client, "ok %.2f", elapsed_ms(&state->control_start));
+    state->control_client = -1;
+}
+
+static const struct wl_callback_listener control_sync_listener = {
+    .done = control_sync_done,
+};
+
+// Read a command from the control socket and apply it
+// The reply waits until the change has been committed
+static void handle_control(struct wlrsetroot_state *state) {
+    char buf[CONTROL_MAX_MESSAGE];
+    char *args[CONTROL_MAX_ARGS];
+    int count;
+    
+    int fd = control_accept(state->control_fd, buf, sizeof(buf),
+                            args, CONTROL_MAX_ARGS, &count);
+    if (fd < 0) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &state->control_start);
+    
+    const char *error;
+    if (!apply_command(state, count, args, &error)) {
+        control_reply(fd, "error %s", error);
+        return;
+    }
+    state->control_client = fd;
+}
+
+// Answer the waiting client once every output shows its change
+// The sync fires after the compositor has processed the commits, which
+// makes the reported time cover the whole change
+static void finish_control(struct wlrsetroot_state *state) {
+    if (state->control_client < 0 || state->control_sync) {
+        return;
+    }
+    
+    struct wlrsetroot_output *output;
+    wl_list_for_each(output, &state->outputs, link) {
+        if (output_needs_render(output)) {
+            return;  // waiting for a buffer release
+        }
+    }
+    
+    state->control_sync = wl_display_sync(state->display);
+    wl_callback_add_listener(state->control_sync, &control_sync_listener, state);
+}
+
+// Read a field in kB, such as VmRSS, from /proc/self/status
+// Returns 0 if it is unavailable
+static unsigned long status_kib(const char *field) {
+    FILE *fp = fopen("/proc/self/status", "r");
+    if (!fp) {
+        return 0;
+    }
+    
+    char line[256];
+    size_t len = strlen(field);
+    unsigned long value = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        if (strncmp(line, field, len) == 0 && line[len] == ':') {
+            value = strtoul(line + len + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(fp);
+    return value;
+}
+
+// -low-rss: drop the client-side mapping of the arena once nothing renders
+// into it. The compositor holds the pool and buffers, so the wallpaper
+// stays up; the arena is mapped again for the next render. Peak and
+// steady-state resident memory are reported the first time and whenever
+// the peak has grown since
+static void unmap_buffers(struct wlrsetroot_state *state) {
+    // -cycle redraws every step; remapping and faulting the arena back in
+    // each time would cost far more than the recolor pass itself
+    if (!state->low_rss || !state->arena || state->cycle_period != 0) {
+        return;
+    }
+    
+    // A speculative render may still be running
+    struct shared_buffer *buf;
+    wl_list_for_each(buf, &state->buffers.buffers, link) {
+        if (buf->bands) {
+            return;
+        }
+    }
+    if (!shm_arena_unmap(state->arena)) {
+        return;
+    }
+    
+    unsigned long peak = status_kib("VmHWM");
+    if (peak > state->rss_peak_reported) {
+        state->rss_peak_reported = peak;
+        fprintf(stderr, "Resident memory: %.1f MiB, peak %.1f MiB, "
+                "shm arena %.1f MiB unmapped\n",
+                status_kib("VmRSS") / 1024.0, peak / 1024.0,
+                shm_arena_size(state->arena) / (1024.0 * 1024.0));
+    }
+}
+
+// Take the -cycle step due by now: over each period fg and bg blend into
+// each other, trade places and blend back. Outputs are marked dirty when a
+// step is taken; with the colors as the only change they are recolored
+static void step_cycle(struct wlrsetroot_state *state) {
+    if (state->cycle_period == 0) {
+        return;
+    }
+    
+    int64_t step = (int64_t)elapsed_ms(&state->cycle_start) / CYCLE_STEP_MS;
+    if (step == state->cycle_step) {
+        return;
+    }
+    state->cycle_step = step;
+    
+    double seconds = (double)step * CYCLE_STEP_MS / 1000;
+    double phase = fmod(seconds, state->cycle_period) / state->cycle_period;
+    state->cycle_mix = (float)((1 - cos(2 * M_PI * phase)) / 2);
+    
+    struct wlrsetroot_output *output;
+    wl_list_for_each(output, &state->outputs, link) {
+        output->dirty = true;
+    }
+}
+
+// Poll timeout until the next -cycle step, -1 to wait for events only
+static int cycle_timeout(const struct wlrsetroot_state *state) {
+    if (state->cycle_period == 0) {
+        return -1;
+    }
+    int64_t elapsed = (int64_t)elapsed_ms(&state->cycle_start);
+    return (int)(CYCLE_STEP_MS - elapsed % CYCLE_STEP_MS);
+}
+
+// Dispatch Wayland events, render and serve the control socket until exit
+// Like a wl_display_dispatch() loop, but also woken by control clients
+static void run_event_loop(struct wlrsetroot_state *state) {
+    struct wl_display *display = state->display;
+    
+    while (state->running && !quit_requested) {
+        while (wl_display_prepare_read(display) != 0) {
+            if (wl_display_dispatch_pending(display) == -1) {
+                return;
+            }
+        }
+        
+        struct pollfd fds[2] = {
+            { .fd = wl_display_get_fd(display), .events = POLLIN },
+            // One command at a time; the next one waits for this reply
+            { .fd = state->control_client < 0 ? state->control_fd : -1, .events = POLLIN },
+        };
+        if (wl_display_flush(display) == -1) {
+            if (errno != EAGAIN) {
+                wl_display_cancel_read(display);
+                return;
+            }
+            fds[0].events |= POLLOUT;
+        }
+        
+        if (poll(fds, 2, cycle_timeout(state)) == -1) {
+            wl_display_cancel_read(display);
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        if (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
+            if (wl_display_read_events(display) == -1) {
+                return;
+            }
+        } else {
+            wl_display_cancel_read(display);
+        }
+        if (wl_display_dispatch_pending(display) == -1) {
+            return;
+        }
+        
+        if (fds[1].revents & POLLIN) {
+            handle_control(state);
+        }
+        
+        // Check for outputs that need rendering
+        step_cycle(state);
+        render_pending_outputs(state);
+        unmap_buffers(state);
+        free_old_images(state);
+        finish_control(state);
+    }
+}
+
+// -send: pass options to a running daemon and report how long the change took
+static int send_command(int argc, char *argv[]) {
+    if (argc == 0) {
+        fprintf(stderr, "Missing options for -send\n");
+        return 1;
+    }
+    
+    // Validated here so mistakes are reported where they were typed
+    struct pattern_options options = {0};
+    int excl = 0;
+    for (int i = 0; i < argc; i++) {
+        int parsed = parse_pattern_option(&options, &excl, true, argc, argv, &i);
+        if (parsed == 0) {
+            fprintf(stderr, "Option not supported by -send: %s\n", argv[i]);
+        }
+        if (parsed <= 0) {
+            return 1;
+        }
+        // The daemon may run in another directory
+        if (options.pattern_file == argv[i]) {
+            argv[i] = realpath(options.pattern_file, NULL);
+            if (!argv[i]) {
+                fprintf(stderr, "Cannot open %s: %s\n", options.pattern_file, strerror(errno));
+                return 1;
+            }
+        }
+    }
+    if (excl > 1) {
+        fprintf(stderr, "Error: choose only one of {-bitmap, -builtin, -gray, -mod, -pbm, -solid}\n");
+        return 1;
+    }
+    
+    char path[CONTROL_PATH_MAX];
+    if (!control_socket_path(path, sizeof(path))) {
+        return 1;
+    }
+    
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    char reply[256];
+    if (!control_send(path, argc, argv, reply, sizeof(reply))) {
+        return 1;
+    }
+    double ms = elapsed_ms(&start);
+    
+    if (strncmp(reply, "ok ", 3) != 0) {
+        fprintf(stderr, "Daemon: %s\n", reply);
+        return 1;
+    }
+    printf("Changed in %.2f ms (%s ms in the daemon)\n", ms, reply + 3);
+    return 0;
+}
+
 static void print_usage(const char *prog) {
     printf("Usage: %s [options]\n"
            "\n"
            "Options:\n"
            "  -bitmap <file>    XBM file to use as wallpaper pattern\n"
+           "  -builtin <name>   Use a compiled-in bitmap, such as leaves or root_weave\n"
+           "  -pbm <file>       Binary PBM (P4) file to use as wallpaper pattern\n"
            "  -mod <x> <y>      Use a plaid-like grid pattern (16x16 tile)\n"
            "  -gray, -grey      Use a gray (checkerboard) pattern\n"
            "  -solid <color>    Solid background color (no pattern)\n"
@@ -434,6 +2147,22 @@ static void print_usage(const char *prog) {
            "  -fg <color>       Foreground color (hex: #rrggbb or rrggbb)\n"
            "  -rv, -reverse     Swap foreground and background colors\n"
            "  -scale <n>        Scale the pattern by factor n (0.1-32, default: 1)\n"
+           "  -filter <f>       Pattern scaling filter: nearest or box (default: nearest)\n"
+           "  -threads <n>      Number of render threads (default: one per CPU)\n"
+           "  -rgb565           Use 16-bit buffers to halve memory and bandwidth\n"
+           "  -hugepages        Back buffers with explicit huge pages if available\n"
+           "  -low-rss          Unmap buffers once committed and report resident memory\n"
+           "  -tile             Show the pattern as a grid of subsurfaces sharing one\n"
+           "                    small tile buffer instead of a full-size buffer\n"
+           "  -span             Lay the pattern out across all outputs as one canvas\n"
+           "  -cycle <seconds>  Blend fg and bg into each other and back over each period\n"
+           "  -cache-size <n>   On-disk render cache limit in MiB, 0 to disable (default: 256)\n"
+           "  -o <file>         Render to a .ppm, .pam or .ff file instead (- for stdout)\n"
+           "  -size <w>x<h>     Image size for -o\n"
+           "  -buffer-scale <n> Output scale for -o (1-8, default: 1)\n"
+           "  -daemon           Keep running and accept changes on a control socket\n"
+           "  -send <options>   Change a daemon's wallpaper; takes the pattern, color,\n"
+           "                    -scale and -filter options (-rv toggles)\n"
            "  -h, --help        Show this help message\n"
            "  -v, --version     Show version\n"
            "\n"
@@ -441,94 +2170,121 @@ static void print_usage(const char *prog) {
            "  %s -bitmap pattern.xbm -bg \"#1a1a2e\" -fg \"#e94560\"\n"
            "  %s -gray -bg \"#1a1a2e\" -fg \"#e94560\"\n"
            "  %s -mod 16 16 -bg \"#282a36\" -fg \"#44475a\"\n"
-           "  %s -solid \"#282a36\"\n",
-           prog, prog, prog, prog, prog);
+           "  %s -solid \"#282a36\"\n"
+           "  %s -gray -scale 2 -o out.ppm -size 3840x2160\n"
+           "  %s -daemon -gray && %s -send -fg \"#e94560\" -scale 2\n",
+           prog, prog, prog, prog, prog, prog, prog, prog);
 }
 
 int main(int argc, char *argv[]) {
     struct wlrsetroot_state state = {0};
     wl_list_init(&state.outputs);
+    buffer_cache_init(&state.buffers);
     
     // Default colors (similar to xsetroot defaults)
-    state.bg_color = 0xFF000000;  // Black
-    state.fg_color = 0xFFFFFFFF;  // White
-    state.pattern_scale = 1.0f;   // No scaling by default
-    state.pattern = PATTERN_NONE;
-    state.reverse = false;
+    state.options.bg_color = 0xFF000000;  // Black
+    state.options.fg_color = 0xFFFFFFFF;  // White
+    state.options.pattern_scale = 1.0f;   // No scaling by default
+    state.options.pattern = PATTERN_NONE;
+    state.options.reverse = false;
+    state.control_fd = -1;
+    state.control_client = -1;
+    state.render_cache_size = RENDER_CACHE_DEFAULT_SIZE;
+    
+    // Client of a running daemon
+    if (argc > 1 && strcmp(argv[1], "-send") == 0) {
+        return send_command(argc - 2, argv + 2);
+    }
     
-    const char *xbm_file = NULL;
+    const char *output_file = NULL;  // offline render target
+    uint32_t file_width = 0, file_height = 0;
+    uint32_t buffer_scale = 1;
+    bool daemon_mode = false;
     int excl = 0;  // Count of exclusive options (bitmap, gray, mod, solid)
     
     // Parse arguments
     for (int i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "-bitmap") == 0) {
+        int parsed = parse_pattern_option(&state.options, &excl, false, argc, argv, &i);
+        if (parsed < 0) {
+            return 1;
+        } else if (parsed > 0) {
+            // Handled by parse_pattern_option()
+        } else if (strcmp(argv[i], "-o") == 0) {
             if (++i >= argc) {
-                fprintf(stderr, "Missing argument for -bitmap\n");
+                fprintf(stderr, "Missing argument for -o\n");
                 return 1;
             }
-            xbm_file = argv[i];
-            state.pattern = PATTERN_XBM;
-            excl++;
-        } else if (strcmp(argv[i], "-gray") == 0 || strcmp(argv[i], "-grey") == 0) {
-            state.pattern = PATTERN_GRAY;
-            excl++;
-        } else if (strcmp(argv[i], "-mod") == 0) {
+            output_file = argv[i];
+        } else if (strcmp(argv[i], "-size") == 0) {
             if (++i >= argc) {
-                fprintf(stderr, "Missing x argument for -mod\n");
+                fprintf(stderr, "Missing argument for -size\n");
                 return 1;
             }
-            state.mod_x = atoi(argv[i]);
-            if (state.mod_x <= 0) state.mod_x = 1;
-            if (++i >= argc) {
-                fprintf(stderr, "Missing y argument for -mod\n");
+            if (sscanf(argv[i], "%ux%u", &file_width, &file_height) != 2 ||
+                file_width == 0 || file_height == 0 ||
+                file_width > MAX_FILE_SIZE || file_height > MAX_FILE_SIZE) {
+                fprintf(stderr, "Invalid size: %s\n", argv[i]);
                 return 1;
             }
-            state.mod_y = atoi(argv[i]);
-            if (state.mod_y <= 0) state.mod_y = 1;
-            state.pattern = PATTERN_MOD;
-            excl++;
-        } else if (strcmp(argv[i], "-bg") == 0) {
+        } else if (strcmp(argv[i], "-buffer-scale") == 0) {
             if (++i >= argc) {
-                fprintf(stderr, "Missing argument for -bg\n");
+                fprintf(stderr, "Missing argument for -buffer-scale\n");
                 return 1;
             }
-            if (!parse_color(argv[i], &state.bg_color)) {
-                fprintf(stderr, "Invalid color: %s\n", argv[i]);
+            int scale = atoi(argv[i]);
+            if (scale < 1 || scale > 8) {
+                fprintf(stderr, "Buffer scale must be between 1 and 8\n");
                 return 1;
             }
-        } else if (strcmp(argv[i], "-fg") == 0) {
+            buffer_scale = scale;
+        } else if (strcmp(argv[i], "-rgb565") == 0) {
+            state.rgb565 = true;
+        } else if (strcmp(argv[i], "-hugepages") == 0) {
+            state.hugepages = true;
+        } else if (strcmp(argv[i], "-low-rss") == 0) {
+            state.low_rss = true;
+        } else if (strcmp(argv[i], "-tile") == 0) {
+            state.tile = true;
+        } else if (strcmp(argv[i], "-span") == 0) {
+            state.span = true;
+        } else if (strcmp(argv[i], "-cycle") == 0) {
             if (++i >= argc) {
-                fprintf(stderr, "Missing argument for -fg\n");
+                fprintf(stderr, "Missing argument for -cycle\n");
                 return 1;
             }
-            if (!parse_color(argv[i], &state.fg_color)) {
-                fprintf(stderr, "Invalid color: %s\n", argv[i]);
+            float seconds = strtof(argv[i], NULL);
+            if (seconds < 1.0f || seconds > MAX_CYCLE_SECONDS) {
+                fprintf(stderr, "Cycle period must be between 1 and %d seconds\n",
+                        MAX_CYCLE_SECONDS);
                 return 1;
             }
-        } else if (strcmp(argv[i], "-rv") == 0 || strcmp(argv[i], "-reverse") == 0) {
-            state.reverse = true;
-        } else if (strcmp(argv[i], "-scale") == 0) {
+            state.cycle_period = seconds;
+        } else if (strcmp(argv[i], "-threads") == 0) {
             if (++i >= argc) {
-                fprintf(stderr, "Missing argument for -scale\n");
+                fprintf(stderr, "Missing argument for -threads\n");
                 return 1;
             }
-            float scale = strtof(argv[i], NULL);
-            if (scale < 0.1f || scale > 32.0f) {
-                fprintf(stderr, "Scale must be between 0.1 and 32\n");
+            int threads = atoi(argv[i]);
+            if (threads < 1 || threads > MAX_THREADS) {
+                fprintf(stderr, "Threads must be between 1 and %d\n", MAX_THREADS);
                 return 1;
             }
-            state.pattern_scale = scale;
-        } else if (strcmp(argv[i], "-solid") == 0) {
+            state.threads = threads;
+        } else if (strcmp(argv[i], "-cache-size") == 0) {
             if (++i >= argc) {
-                fprintf(stderr, "Missing argument for -solid\n");
+                fprintf(stderr, "Missing argument for -cache-size\n");
                 return 1;
             }
-            if (!parse_color(argv[i], &state.bg_color)) {
-                fprintf(stderr, "Invalid color: %s\n", argv[i]);
+            char *end;
+            unsigned long megabytes = strtoul(argv[i], &end, 10);
+            if (*end != '\0' || megabytes > MAX_CACHE_SIZE_MB) {
+                fprintf(stderr, "Cache size must be between 0 and %d MiB\n",
+                        MAX_CACHE_SIZE_MB);
                 return 1;
             }
-            state.pattern = PATTERN_NONE;
-            excl++;
+            state.render_cache_size = (size_t)megabytes << 20;
+        } else if (strcmp(argv[i], "-daemon") == 0) {
+            daemon_mode = true;
         } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
             print_usage(argv[0]);
             return 0;
@@ -544,33 +2300,96 @@ int main(int argc, char *argv[]) {
     
     // Check for multiple exclusive options
     if (excl > 1) {
-        fprintf(stderr, "Error: choose only one of {-bitmap, -gray, -mod, -solid}\n");
+        fprintf(stderr, "Error: choose only one of {-bitmap, -builtin, -gray, -mod, -pbm, -solid}\n");
+        return 1;
+    }
+    
+    if (output_file && file_width == 0) {
+        fprintf(stderr, "Error: -o requires -size\n");
+        return 1;
+    }
+    
+    if (state.tile && state.span) {
+        fprintf(stderr, "Error: -tile cannot be used with -span\n");
+        return 1;
+    }
+    
+    if (output_file && daemon_mode) {
+        fprintf(stderr, "Error: -o cannot be used with -daemon\n");
+        return 1;
+    }
+    
+    if (output_file && state.cycle_period > 0) {
+        fprintf(stderr, "Error: -o cannot be used with -cycle\n");
         return 1;
     }
+    clock_gettime(CLOCK_MONOTONIC, &state.cycle_start);
+    
+    bit_expand_init();
+    
+    struct pattern_job pattern_job = {
+        .state = &state,
+    };
     
-    // Load XBM file if specified
-    if (state.pattern == PATTERN_XBM && xbm_file) {
-        state.xbm = xbm_load(xbm_file);
-        if (!state.xbm) {
-            fprintf(stderr, "Failed to load XBM file: %s\n", xbm_file);
+    // Offline mode: render straight to a file, no compositor needed
+    if (output_file) {
+        load_pattern(&pattern_job);
+        if (!pattern_job.ok) {
             return 1;
         }
+        
+        struct render_params params;
+        get_render_params(&state, &params);
+        bool ok = image_file_render(output_file,
+                                    image_file_format_from_name(output_file),
+                                    &params, file_width * buffer_scale,
+                                    file_height * buffer_scale);
+        xbm_free(state.xbm);
+        return ok ? 0 : 1;
+    }
+    
+    if (state.threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        state.threads = cpus < 1 ? 1 : cpus > MAX_THREADS ? MAX_THREADS : (unsigned int)cpus;
+    }
+    state.workers = worker_pool_create(state.threads);
+    if (!state.workers) {
+        fprintf(stderr, "Failed to create render threads\n");
+        return 1;
     }
     
     // Connect to Wayland
     state.display = wl_display_connect(NULL);
     if (!state.display) {
         fprintf(stderr, "Failed to connect to Wayland display\n");
-        xbm_free(state.xbm);
+        worker_pool_destroy(state.workers);
         return 1;
     }
     
     state.registry = wl_display_get_registry(state.display);
     wl_registry_add_listener(state.registry, &registry_listener, &state);
+    wl_display_flush(state.display);
+    
+    // Load the pattern while the compositor answers; with a single thread
+    // the job runs inline, still overlapping the request already sent
+    worker_pool_submit(state.workers, load_pattern, &pattern_job);
     
-    // First roundtrip to get globals
+    // Roundtrip to get globals
     wl_display_roundtrip(state.display);
+    worker_pool_wait(state.workers);
     
+    // Marks when wl_shm's formats are in, without blocking on another
+    // roundtrip; see choose_shm_format()
+    if (state.shm) {
+        state.shm_sync = wl_display_sync(state.display);
+        wl_callback_add_listener(state.shm_sync, &shm_sync_listener, &state);
+    }
+    
+    struct wlrsetroot_output *output, *tmp;
+    int ret = 1;
+    if (!pattern_job.ok) {
+        goto cleanup;
+    }
     if (!state.compositor) {
         fprintf(stderr, "Compositor does not support wl_compositor\n");
         goto cleanup;
@@ -584,34 +2403,88 @@ int main(int argc, char *argv[]) {
         goto cleanup;
     }
     
-    // Second roundtrip to get output info and create layer surfaces
-    wl_display_roundtrip(state.display);
+    state.arena = shm_arena_create(state.shm, state.hugepages ? SHM_ARENA_HUGETLB : 0);
+    if (!state.arena) {
+        fprintf(stderr, "Failed to create shm arena\n");
+        goto cleanup;
+    }
     
-    // Main loop
-    state.running = true;
-    while (state.running && wl_display_dispatch(state.display) != -1) {
-        // Check for outputs that need rendering
-        struct wlrsetroot_output *output;
-        wl_list_for_each(output, &state.outputs, link) {
-            if (output->configured && output->buffer.buffer == NULL) {
-                render_output(output);
-            }
+    if (state.render_cache_size > 0) {
+        state.render_cache = render_cache_open(state.render_cache_size);
+    }
+    
+    if (daemon_mode) {
+        if (!control_socket_path(state.control_path, sizeof(state.control_path))) {
+            goto cleanup;
+        }
+        state.control_fd = control_listen(state.control_path);
+        if (state.control_fd < 0) {
+            goto cleanup;
+        }
+        
+        // Leave through cleanup so the socket file is removed
+        struct sigaction sa = { .sa_handler = handle_quit_signal };
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+    }
+    ret = 0;
+    
+    // Layer surfaces are created as each output's properties complete;
+    // those that did so during the roundtrip are set up now
+    state.ready = true;
+    wl_list_for_each(output, &state.outputs, link) {
+        if (output->done) {
+            setup_output(output);
         }
     }
     
+    // Main loop
+    state.running = true;
+    run_event_loop(&state);
+    
 cleanup:
+    if (state.control_client >= 0) {
+        control_reply(state.control_client, "error daemon exiting");
+    }
+    if (state.control_sync) {
+        wl_callback_destroy(state.control_sync);
+    }
+    if (state.shm_sync) {
+        wl_callback_destroy(state.shm_sync);
+    }
+    if (state.control_fd >= 0) {
+        close(state.control_fd);
+        unlink(state.control_path);
+    }
+    
     // Cleanup outputs
-    struct wlrsetroot_output *output, *tmp;
     wl_list_for_each_safe(output, tmp, &state.outputs, link) {
         destroy_output(output);
     }
     
+    shared_buffer_unref(state.canvas);
+    shm_arena_destroy(state.arena);
+    render_cache_close(state.render_cache);
+    
+    if (state.single_pixel) {
+        wp_single_pixel_buffer_manager_v1_destroy(state.single_pixel);
+    }
+    if (state.fractional_scale) {
+        wp_fractional_scale_manager_v1_destroy(state.fractional_scale);
+    }
+    if (state.viewporter) {
+        wp_viewporter_destroy(state.viewporter);
+    }
     if (state.layer_shell) {
         zwlr_layer_shell_v1_destroy(state.layer_shell);
     }
     if (state.shm) {
         wl_shm_destroy(state.shm);
     }
+    if (state.subcompositor) {
+        wl_subcompositor_destroy(state.subcompositor);
+    }
     if (state.compositor) {
         wl_compositor_destroy(state.compositor);
     }
@@ -622,7 +2495,12 @@ cleanup:
         wl_display_disconnect(state.display);
     }
     
+    worker_pool_destroy(state.workers);
     xbm_free(state.xbm);
+    for (size_t i = 0; i < state.old_image_count; i++) {
+        xbm_free(state.old_images[i]);
+    }
+    free(state.old_images);
     
-    return 0;
+    return ret;
 }
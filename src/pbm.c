@@ -0,0 +1,122 @@
+#define _DEFAULT_SOURCE
+
+#include "xbm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Largest width or height accepted from a file, as for XBM
+#define PBM_MAX_DIMENSION 65536
+
+static bool is_space(unsigned char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Skip whitespace and comments, which run from '#' to the end of the line
+static size_t skip_space(const unsigned char *data, size_t size, size_t pos) {
+    while (pos < size) {
+        if (data[pos] == '#') {
+            while (pos < size && data[pos] != '\n') {
+                pos++;
+            }
+        } else if (is_space(data[pos])) {
+            pos++;
+        } else {
+            break;
+        }
+    }
+    return pos;
+}
+
+// Read a positive decimal dimension after optional whitespace
+static bool read_dimension(const unsigned char *data, size_t size, size_t *pos,
+                           unsigned int *value) {
+    size_t p = skip_space(data, size, *pos);
+    unsigned long v = 0;
+    size_t start = p;
+    while (p < size && data[p] >= '0' && data[p] <= '9') {
+        v = v * 10 + (data[p] - '0');
+        if (v > PBM_MAX_DIMENSION) {
+            return false;
+        }
+        p++;
+    }
+    if (p == start || v == 0) {
+        return false;
+    }
+    *value = (unsigned int)v;
+    *pos = p;
+    return true;
+}
+
+struct xbm_image *pbm_load(const char *filename) {
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open PBM file '%s': %s\n", filename, strerror(errno));
+        return NULL;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        fprintf(stderr, "PBM file '%s' is not a regular, non-empty file\n", filename);
+        close(fd);
+        return NULL;
+    }
+    
+    // The rows are used straight from the page cache; mmap offsets must be
+    // page aligned, so the whole file is mapped and bits points past the header
+    size_t size = (size_t)st.st_size;
+    unsigned char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Failed to map PBM file '%s': %s\n", filename, strerror(errno));
+        return NULL;
+    }
+    
+    // Header: "P4", width and height separated by whitespace or comments,
+    // then a single whitespace byte before the raster
+    unsigned int width, height;
+    size_t pos = 2;
+    if (size < 2 || data[0] != 'P' || data[1] != '4') {
+        fprintf(stderr, "%s: not a binary PBM (P4) file\n", filename);
+        goto error;
+    }
+    if (!read_dimension(data, size, &pos, &width) ||
+        !read_dimension(data, size, &pos, &height) ||
+        pos >= size || !is_space(data[pos])) {
+        fprintf(stderr, "%s: malformed PBM header\n", filename);
+        goto error;
+    }
+    pos++;
+    
+    // Only the first image of a multi-image file is used
+    size_t raster = (size_t)(width + 7) / 8 * height;
+    if (size - pos < raster) {
+        fprintf(stderr, "%s: PBM data truncated, expected %zu bytes\n", filename, raster);
+        goto error;
+    }
+    
+    struct xbm_image *image = calloc(1, sizeof(*image));
+    if (!image) {
+        goto error;
+    }
+    image->width = width;
+    image->height = height;
+    image->bits = data + pos;
+    image->hotspot_x = -1;
+    image->hotspot_y = -1;
+    image->msb_first = true;
+    image->mapping = data;
+    image->mapping_size = size;
+    return image;
+    
+error:
+    munmap(data, size);
+    return NULL;
+}
@@ -1,9 +1,11 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 
 #include "pool-buffer.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,6 +13,32 @@
 #include <time.h>
 #include <unistd.h>
 
+struct arena_block {
+    struct wl_list link;  // shm_arena.free_blocks, sorted by offset
+    size_t offset;
+    size_t size;
+};
+
+// Size of a transparent or explicit huge page
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+struct shm_arena {
+    struct wl_shm *shm;
+    struct wl_shm_pool *pool;
+    int fd;
+    void *data;
+    size_t size;
+    size_t allocated;
+    size_t page_size;  // allocation granularity
+    
+    bool hugetlb;  // fd is a MFD_HUGETLB memfd
+    bool thp;  // shmem transparent huge pages can be requested
+    
+    struct wl_list free_blocks;  // list of arena_block
+    struct wl_list buffers;  // list of pool_buffer, rebased on remap
+};
+
+// Fallback for systems without memfd_create
 static int create_shm_file(void) {
     int retries = 100;
     
@@ -35,50 +63,548 @@ static int create_shm_file(void) {
     return -1;
 }
 
-bool pool_buffer_create(struct pool_buffer *buf, struct wl_shm *shm,
-                        uint32_t width, uint32_t height, uint32_t format) {
-    uint32_t stride = width * 4;  // 4 bytes per pixel (ARGB8888)
-    size_t size = (size_t)stride * height;
+static int create_arena_file(bool hugetlb) {
+    unsigned int flags = MFD_CLOEXEC | MFD_ALLOW_SEALING;
+    if (hugetlb) {
+        flags |= MFD_HUGETLB;
+    }
     
-    int fd = create_shm_file();
+    int fd = memfd_create("wlrsetroot", flags);
     if (fd < 0) {
-        fprintf(stderr, "Failed to create shm file: %s\n", strerror(errno));
+        return hugetlb ? -1 : create_shm_file();
+    }
+    
+    // The arena only ever grows, so promise the compositor it won't shrink
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL);
+    return fd;
+}
+
+// Whether shmem mappings honour MADV_HUGEPAGE on this system
+static bool shmem_thp_enabled(void) {
+    FILE *fp = fopen("/sys/kernel/mm/transparent_hugepage/shmem_enabled", "r");
+    if (!fp) {
         return false;
     }
     
-    if (ftruncate(fd, size) < 0) {
+    char line[128];
+    bool enabled = false;
+    if (fgets(line, sizeof(line), fp)) {
+        enabled = !strstr(line, "[never]") && !strstr(line, "[deny]");
+    }
+    fclose(fp);
+    return enabled;
+}
+
+// Fault in a fresh range now, so the page faults don't land in the render
+static void prefault(void *data, size_t size) {
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(data, size, MADV_POPULATE_WRITE) == 0) {
+        return;
+    }
+#endif
+    
+    // Kernels before 5.14: touch one byte per base page
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    volatile uint8_t *bytes = data;
+    for (size_t offset = 0; offset < size; offset += page_size) {
+        bytes[offset] = 0;
+    }
+}
+
+// Drop back from explicit huge pages to regular shmem
+// Only possible before the first mapping, while nothing is allocated
+static void arena_disable_hugetlb(struct shm_arena *arena) {
+    fprintf(stderr, "Huge pages unavailable, using regular shared memory\n");
+    if (arena->fd >= 0) {
+        close(arena->fd);
+        arena->fd = -1;
+    }
+    arena->hugetlb = false;
+    arena->thp = shmem_thp_enabled();
+    arena->page_size = arena->thp ? HUGE_PAGE_SIZE : (size_t)sysconf(_SC_PAGESIZE);
+}
+
+// Return a range to the free list, merging it with adjacent free ranges
+static bool arena_free(struct shm_arena *arena, size_t offset, size_t size) {
+    struct arena_block *prev = NULL, *next = NULL, *block;
+    wl_list_for_each(block, &arena->free_blocks, link) {
+        if (block->offset > offset) {
+            next = block;
+            break;
+        }
+        prev = block;
+    }
+    
+    if (prev && prev->offset + prev->size == offset) {
+        prev->size += size;
+        if (next && prev->offset + prev->size == next->offset) {
+            prev->size += next->size;
+            wl_list_remove(&next->link);
+            free(next);
+        }
+        return true;
+    }
+    if (next && offset + size == next->offset) {
+        next->offset = offset;
+        next->size += size;
+        return true;
+    }
+    
+    block = calloc(1, sizeof(*block));
+    if (!block) {
+        return false;
+    }
+    block->offset = offset;
+    block->size = size;
+    wl_list_insert(prev ? &prev->link : &arena->free_blocks, &block->link);
+    return true;
+}
+
+// Grow the file, the compositor's pool and our mapping to new_size
+static bool arena_grow(struct shm_arena *arena, size_t new_size) {
+    if (new_size > INT32_MAX) {
+        fprintf(stderr, "shm arena would exceed %d bytes\n", INT32_MAX);
+        return false;
+    }
+    
+    if (arena->fd < 0) {
+        arena->fd = create_arena_file(arena->hugetlb);
+        if (arena->fd < 0 && arena->hugetlb) {
+            arena_disable_hugetlb(arena);
+            return arena_grow(arena, new_size);
+        }
+        if (arena->fd < 0) {
+            fprintf(stderr, "Failed to create shm file: %s\n", strerror(errno));
+            return false;
+        }
+    }
+    
+    if (ftruncate(arena->fd, new_size) < 0) {
         fprintf(stderr, "Failed to set shm file size: %s\n", strerror(errno));
-        close(fd);
         return false;
     }
     
-    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // hugetlb reserves its pages here, so this fails cleanly if none are free
+    void *data = mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      arena->fd, 0);
+    if (data == MAP_FAILED && arena->hugetlb && !arena->pool) {
+        arena_disable_hugetlb(arena);
+        return arena_grow(arena, new_size);
+    }
     if (data == MAP_FAILED) {
         fprintf(stderr, "Failed to mmap shm file: %s\n", strerror(errno));
-        close(fd);
         return false;
     }
     
-    struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, size);
-    buf->buffer = wl_shm_pool_create_buffer(pool, 0, width, height, stride, format);
-    wl_shm_pool_destroy(pool);
-    close(fd);
+    if (arena->thp) {
+        madvise(data, new_size, MADV_HUGEPAGE);
+    }
+    
+    if (!arena_free(arena, arena->size, new_size - arena->size)) {
+        munmap(data, new_size);
+        return false;
+    }
+    
+    if (arena->data) {
+        munmap(arena->data, arena->size);
+    }
+    arena->data = data;
+    
+    // Existing buffers keep their offsets but move with the mapping
+    struct pool_buffer *buf;
+    wl_list_for_each(buf, &arena->buffers, link) {
+        buf->data = (uint8_t *)data + buf->offset;
+    }
+    
+    if (arena->pool) {
+        wl_shm_pool_resize(arena->pool, (int32_t)new_size);
+    } else {
+        arena->pool = wl_shm_create_pool(arena->shm, arena->fd, (int32_t)new_size);
+    }
+    arena->size = new_size;
+    return true;
+}
+
+// First-fit allocation from the free list, growing the arena if needed
+static bool arena_alloc(struct shm_arena *arena, size_t size, size_t *offset) {
+    struct arena_block *block, *last = NULL;
+    wl_list_for_each(block, &arena->free_blocks, link) {
+        if (block->size >= size) {
+            goto found;
+        }
+        last = block;
+    }
+    
+    // Extend the free block at the end of the arena if there is one
+    size_t tail = last && last->offset + last->size == arena->size ? last->size : 0;
+    if (!arena_grow(arena, arena->size + size - tail)) {
+        return false;
+    }
+    block = wl_container_of(arena->free_blocks.prev, block, link);
+    
+found:
+    *offset = block->offset;
+    block->offset += size;
+    block->size -= size;
+    if (block->size == 0) {
+        wl_list_remove(&block->link);
+        free(block);
+    }
+    arena->allocated += size;
+    return true;
+}
+
+struct shm_arena *shm_arena_create(struct wl_shm *shm, uint32_t flags) {
+    struct shm_arena *arena = calloc(1, sizeof(*arena));
+    if (!arena) {
+        return NULL;
+    }
+    
+    arena->shm = shm;
+    arena->fd = -1;
+    arena->hugetlb = flags & SHM_ARENA_HUGETLB;
+    arena->thp = !arena->hugetlb && shmem_thp_enabled();
+    
+    // Huge page backed arenas hand out whole huge pages so every buffer
+    // starts on a huge page boundary
+    if (arena->hugetlb || arena->thp) {
+        arena->page_size = HUGE_PAGE_SIZE;
+    } else {
+        arena->page_size = (size_t)sysconf(_SC_PAGESIZE);
+    }
+    wl_list_init(&arena->free_blocks);
+    wl_list_init(&arena->buffers);
+    return arena;
+}
+
+void shm_arena_destroy(struct shm_arena *arena) {
+    if (!arena) {
+        return;
+    }
+    
+    struct arena_block *block, *tmp;
+    wl_list_for_each_safe(block, tmp, &arena->free_blocks, link) {
+        wl_list_remove(&block->link);
+        free(block);
+    }
+    
+    if (arena->pool) {
+        wl_shm_pool_destroy(arena->pool);
+    }
+    if (arena->data) {
+        munmap(arena->data, arena->size);
+    }
+    if (arena->fd >= 0) {
+        close(arena->fd);
+    }
+    free(arena);
+}
+
+bool shm_arena_unmap(struct shm_arena *arena) {
+    if (!arena->data) {
+        return false;
+    }
+    
+    munmap(arena->data, arena->size);
+    arena->data = NULL;
+    
+    struct pool_buffer *buf;
+    wl_list_for_each(buf, &arena->buffers, link) {
+        buf->data = NULL;
+        buf->faulted = false;
+    }
+    return true;
+}
+
+bool shm_arena_map(struct shm_arena *arena) {
+    if (arena->data || arena->size == 0) {
+        return true;
+    }
+    
+    void *data = mmap(NULL, arena->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      arena->fd, 0);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Failed to mmap shm file: %s\n", strerror(errno));
+        return false;
+    }
+    if (arena->thp) {
+        madvise(data, arena->size, MADV_HUGEPAGE);
+    }
+    arena->data = data;
     
-    buf->data = data;
+    struct pool_buffer *buf;
+    wl_list_for_each(buf, &arena->buffers, link) {
+        buf->data = (uint8_t *)data + buf->offset;
+    }
+    return true;
+}
+
+size_t shm_arena_allocated(const struct shm_arena *arena) {
+    return arena->allocated;
+}
+
+size_t shm_arena_size(const struct shm_arena *arena) {
+    return arena->size;
+}
+
+static uint32_t format_bytes_per_pixel(uint32_t format) {
+    return format == WL_SHM_FORMAT_RGB565 ? 2 : 4;
+}
+
+static void buffer_release(void *data, struct wl_buffer *wl_buffer) {
+    (void)wl_buffer;
+    struct pool_buffer *buf = data;
+    buf->busy = false;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+    .release = buffer_release,
+};
+
+bool pool_buffer_create(struct pool_buffer *buf, struct shm_arena *arena,
+                        uint32_t width, uint32_t height, uint32_t format) {
+    if (!shm_arena_map(arena)) {
+        return false;
+    }
+    
+    // Rows stay 4-byte aligned for 16-bit formats with odd widths
+    uint32_t stride = (width * format_bytes_per_pixel(format) + 3) & ~3u;
+    size_t size = (size_t)stride * height;
+    
+    // Keep every buffer page aligned
+    size_t alloc_size = (size + arena->page_size - 1) & ~(arena->page_size - 1);
+    
+    size_t offset;
+    if (!arena_alloc(arena, alloc_size, &offset)) {
+        return false;
+    }
+    
+    buf->buffer = wl_shm_pool_create_buffer(arena->pool, (int32_t)offset,
+                                            width, height, stride, format);
+    wl_buffer_add_listener(buf->buffer, &buffer_listener, buf);
+    buf->data = (uint8_t *)arena->data + offset;
+    prefault(buf->data, size);
+    buf->faulted = true;
+    buf->width = width;
+    buf->height = height;
+    buf->stride = stride;
+    buf->format = format;
+    buf->busy = false;
+    buf->size = alloc_size;
+    buf->arena = arena;
+    buf->offset = offset;
+    wl_list_insert(&arena->buffers, &buf->link);
+    wl_list_init(&buf->views);
+    
+    return true;
+}
+
+bool pool_buffer_reshape(struct pool_buffer *buf, uint32_t width, uint32_t height,
+                         uint32_t format) {
+    if (!buf->arena || width * format_bytes_per_pixel(format) > buf->stride ||
+        (size_t)buf->stride * height > buf->size) {
+        return false;
+    }
+    
+    buf->buffer = wl_shm_pool_create_buffer(buf->arena->pool, (int32_t)buf->offset,
+                                            width, height, buf->stride, format);
+    wl_buffer_add_listener(buf->buffer, &buffer_listener, buf);
     buf->width = width;
     buf->height = height;
-    buf->size = size;
+    buf->format = format;
+    return true;
+}
+
+bool pool_buffer_read(struct pool_buffer *buf, int fd, off_t offset) {
+    size_t size = (size_t)buf->stride * buf->height;
+    size_t done = 0;
+    
+    // hugetlbfs files can only be written through a mapping
+    if (buf->arena && !buf->arena->hugetlb) {
+        loff_t in = offset;
+        loff_t out = (loff_t)buf->offset;
+        while (done < size) {
+            ssize_t n = copy_file_range(fd, &in, buf->arena->fd, &out, size - done, 0);
+            if (n <= 0) {
+                break;  // EXDEV and friends: finish with plain reads
+            }
+            done += (size_t)n;
+        }
+    }
+    
+    while (done < size) {
+        ssize_t n = pread(fd, (uint8_t *)buf->data + done, size - done,
+                          offset + (off_t)done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        done += (size_t)n;
+    }
+    return true;
+}
+
+void pool_buffer_attach(struct pool_buffer *buf, struct wl_surface *surface) {
+    wl_surface_attach(surface, buf->buffer, 0, 0);
+    buf->busy = true;
+}
+
+bool pool_buffer_busy(const struct pool_buffer *buf) {
+    if (buf->busy) {
+        return true;
+    }
+    if (!buf->arena) {
+        return false;
+    }
+    
+    struct pool_buffer_view *view;
+    wl_list_for_each(view, &buf->views, link) {
+        if (view->busy) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void view_release(void *data, struct wl_buffer *wl_buffer) {
+    (void)wl_buffer;
+    struct pool_buffer_view *view = data;
+    view->busy = false;
+}
+
+static const struct wl_buffer_listener view_listener = {
+    .release = view_release,
+};
+
+bool pool_buffer_view_create(struct pool_buffer_view *view, struct pool_buffer *buf,
+                             uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    if (!buf->arena || x + width > buf->width || y + height > buf->height) {
+        return false;
+    }
     
+    size_t offset = buf->offset + (size_t)y * buf->stride +
+                    (size_t)x * format_bytes_per_pixel(buf->format);
+    view->buffer = wl_shm_pool_create_buffer(buf->arena->pool, (int32_t)offset,
+                                             width, height, buf->stride, buf->format);
+    if (!view->buffer) {
+        return false;
+    }
+    wl_buffer_add_listener(view->buffer, &view_listener, view);
+    view->parent = buf;
+    view->busy = false;
+    wl_list_insert(&buf->views, &view->link);
     return true;
 }
 
+void pool_buffer_view_attach(struct pool_buffer_view *view, struct wl_surface *surface) {
+    wl_surface_attach(surface, view->buffer, 0, 0);
+    view->busy = true;
+}
+
+void pool_buffer_view_destroy(struct pool_buffer_view *view) {
+    if (view->buffer) {
+        wl_buffer_destroy(view->buffer);
+        view->buffer = NULL;
+    }
+    if (view->parent) {
+        wl_list_remove(&view->link);
+        view->parent = NULL;
+    }
+    view->busy = false;
+}
+
 void pool_buffer_destroy(struct pool_buffer *buf) {
     if (buf->buffer) {
         wl_buffer_destroy(buf->buffer);
         buf->buffer = NULL;
     }
-    if (buf->data) {
-        munmap(buf->data, buf->size);
-        buf->data = NULL;
+    if (buf->arena) {
+        // Views left behind keep a wl_buffer that must not be attached again
+        struct pool_buffer_view *view, *tmp;
+        wl_list_for_each_safe(view, tmp, &buf->views, link) {
+            wl_list_remove(&view->link);
+            view->parent = NULL;
+        }
+        wl_list_remove(&buf->link);
+        buf->arena->allocated -= buf->size;
+        if (!arena_free(buf->arena, buf->offset, buf->size)) {
+            fprintf(stderr, "Leaking %zu bytes of shm\n", buf->size);
+        }
+        buf->arena = NULL;
+    }
+    buf->data = NULL;
+    buf->busy = false;
+    buf->faulted = false;
+}
+
+// Fault a reused slot back in after the arena was unmapped
+static struct pool_buffer *fault_in(struct pool_buffer *slot) {
+    if (!slot->faulted) {
+        prefault(slot->data, (size_t)slot->stride * slot->height);
+        slot->faulted = true;
+    }
+    return slot;
+}
+
+void buffer_pool_init(struct buffer_pool *pool, struct shm_arena *arena) {
+    memset(pool, 0, sizeof(*pool));
+    pool->arena = arena;
+}
+
+struct pool_buffer *buffer_pool_acquire(struct buffer_pool *pool, uint32_t width,
+                                        uint32_t height, uint32_t format) {
+    struct pool_buffer *empty = NULL;
+    struct pool_buffer *spare = NULL;
+    
+    if (!shm_arena_map(pool->arena)) {
+        return NULL;
+    }
+    
+    for (int i = 0; i < BUFFER_POOL_SLOTS; i++) {
+        struct pool_buffer *slot = &pool->slots[i];
+        if (pool_buffer_busy(slot)) {
+            continue;
+        }
+        if (!slot->buffer) {
+            empty = empty ? empty : slot;
+            continue;
+        }
+        if (slot->width == width && slot->height == height && slot->format == format) {
+            return fault_in(slot);
+        }
+        
+        // Smaller frames fit in the memory of a larger one
+        struct wl_buffer *old = slot->buffer;
+        if (pool_buffer_reshape(slot, width, height, format)) {
+            wl_buffer_destroy(old);
+            return fault_in(slot);
+        }
+        spare = spare ? spare : slot;
+    }
+    
+    struct pool_buffer *slot = empty ? empty : spare;
+    if (!slot) {
+        return NULL;
+    }
+    pool_buffer_destroy(slot);
+    if (!pool_buffer_create(slot, pool->arena, width, height, format)) {
+        return NULL;
+    }
+    return slot;
+}
+
+uint32_t buffer_pool_busy_count(const struct buffer_pool *pool) {
+    uint32_t count = 0;
+    for (int i = 0; i < BUFFER_POOL_SLOTS; i++) {
+        count += pool_buffer_busy(&pool->slots[i]);
+    }
+    return count;
+}
+
+void buffer_pool_finish(struct buffer_pool *pool) {
+    for (int i = 0; i < BUFFER_POOL_SLOTS; i++) {
+        pool_buffer_destroy(&pool->slots[i]);
     }
 }
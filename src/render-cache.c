@@ -0,0 +1,323 @@
+#define _GNU_SOURCE
+
+#include "render-cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "xbm.h"
+
+// Bump when the renderer's output changes, so old files stop matching
+#define CACHE_VERSION 2
+
+static const char cache_magic[8] = "WLRSRBUF";
+
+struct render_cache {
+    int dir_fd;
+    size_t max_size;
+};
+
+// Everything a cache file's contents depend on, but the tile's bits
+// Stored at the start of the file, followed by the tile's bits. Both are
+// compared in full on lookup, so a file name collision can never show the
+// wrong wallpaper
+struct cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t format;  // wl_shm format
+    uint32_t pixel_format;
+    uint32_t filter;
+    uint32_t fg;
+    uint32_t bg;
+    uint32_t scale;  // bits of the float scale factor
+    uint32_t tile_width;
+    uint32_t tile_height;
+    uint32_t tile_msb_first;  // bit order of the tile rows
+    uint64_t tile_hash;  // only spreads file names, the bits are compared
+};
+
+// Tiles must fit between the header and the pixel rows to be cached
+#define TILE_MAX_SIZE (RENDER_CACHE_DATA_OFFSET - sizeof(struct cache_header))
+
+struct cache_entry {
+    char name[64];
+    off_t size;
+    struct timespec mtime;
+};
+
+// 64-bit FNV-1a style hash, a word at a time
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    const uint64_t prime = 0x100000001b3ull;
+    
+    for (; size >= 8; size -= 8, bytes += 8) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        hash = (hash ^ word) * prime;
+        hash ^= hash >> 29;
+    }
+    for (; size > 0; size--, bytes++) {
+        hash = (hash ^ *bytes) * prime;
+    }
+    return hash;
+}
+
+// Bits of the tile a key renders, and their size
+static const unsigned char *tile_bits(const struct buffer_key *key, size_t *size) {
+    const struct xbm_image *image = key->params.image;
+    if (!image) {
+        *size = 0;
+        return NULL;
+    }
+    *size = (size_t)(image->width + 7) / 8 * image->height;
+    return image->bits;
+}
+
+static void build_header(struct cache_header *header, const struct buffer_key *key,
+                         uint32_t stride) {
+    const struct render_params *params = &key->params;
+    
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, cache_magic, sizeof(header->magic));
+    header->version = CACHE_VERSION;
+    header->width = key->width;
+    header->height = key->height;
+    header->stride = stride;
+    header->format = key->format;
+    header->pixel_format = params->format;
+    header->filter = params->filter;
+    header->fg = params->fg;
+    header->bg = params->bg;
+    memcpy(&header->scale, &params->scale, sizeof(header->scale));
+    
+    if (params->image) {
+        const struct xbm_image *image = params->image;
+        header->tile_width = image->width;
+        header->tile_height = image->height;
+        header->tile_msb_first = image->msb_first;
+        size_t tile_size;
+        const unsigned char *bits = tile_bits(key, &tile_size);
+        header->tile_hash = hash_bytes(0xcbf29ce484222325ull, bits, tile_size);
+    }
+}
+
+static void file_name(const struct cache_header *header, char *name, size_t size) {
+    snprintf(name, size, "%016" PRIx64,
+             hash_bytes(0xcbf29ce484222325ull, header, sizeof(*header)));
+}
+
+// Create a directory unless it exists
+static bool make_dir(const char *path) {
+    if (mkdir(path, 0700) < 0 && errno != EEXIST) {
+        fprintf(stderr, "Failed to create %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+struct render_cache *render_cache_open(size_t max_size) {
+    char path[4096];
+    const char *base = getenv("XDG_CACHE_HOME");
+    if (base && *base) {
+        snprintf(path, sizeof(path), "%s", base);
+    } else {
+        const char *home = getenv("HOME");
+        if (!home || !*home) {
+            return NULL;
+        }
+        snprintf(path, sizeof(path), "%s/.cache", home);
+    }
+    if (!make_dir(path)) {
+        return NULL;
+    }
+    size_t len = strlen(path);
+    snprintf(path + len, sizeof(path) - len, "/wlrsetroot");
+    if (!make_dir(path)) {
+        return NULL;
+    }
+    
+    int dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    
+    struct render_cache *cache = calloc(1, sizeof(*cache));
+    if (!cache) {
+        close(dir_fd);
+        return NULL;
+    }
+    cache->dir_fd = dir_fd;
+    cache->max_size = max_size;
+    return cache;
+}
+
+void render_cache_close(struct render_cache *cache) {
+    if (!cache) {
+        return;
+    }
+    close(cache->dir_fd);
+    free(cache);
+}
+
+int render_cache_lookup(struct render_cache *cache, const struct buffer_key *key,
+                        uint32_t stride) {
+    size_t tile_size;
+    const unsigned char *bits = tile_bits(key, &tile_size);
+    if (tile_size > TILE_MAX_SIZE) {
+        return -1;
+    }
+    
+    struct cache_header expected;
+    build_header(&expected, key, stride);
+    char name[32];
+    file_name(&expected, name, sizeof(name));
+    
+    int fd = openat(cache->dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    struct cache_header header;
+    unsigned char stored_bits[TILE_MAX_SIZE];
+    struct stat st;
+    off_t size = RENDER_CACHE_DATA_OFFSET + (off_t)stride * key->height;
+    if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(&header, &expected, sizeof(header)) != 0 ||
+        pread(fd, stored_bits, tile_size, sizeof(header)) != (ssize_t)tile_size ||
+        (tile_size > 0 && memcmp(stored_bits, bits, tile_size) != 0) ||
+        fstat(fd, &st) < 0 || st.st_size != size) {
+        close(fd);
+        return -1;
+    }
+    
+    // The modification time orders files for eviction
+    futimens(fd, NULL);
+    return fd;
+}
+
+// Write all of buf at offset
+static bool write_at(int fd, const void *buf, size_t size, off_t offset) {
+    const unsigned char *bytes = buf;
+    while (size > 0) {
+        ssize_t n = pwrite(fd, bytes, size, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= (size_t)n;
+        offset += n;
+    }
+    return true;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    const struct cache_entry *ea = a, *eb = b;
+    if (ea->mtime.tv_sec != eb->mtime.tv_sec) {
+        return ea->mtime.tv_sec < eb->mtime.tv_sec ? -1 : 1;
+    }
+    if (ea->mtime.tv_nsec != eb->mtime.tv_nsec) {
+        return ea->mtime.tv_nsec < eb->mtime.tv_nsec ? -1 : 1;
+    }
+    return 0;
+}
+
+// Remove the least recently used files until the directory fits max_size
+static void evict(struct render_cache *cache) {
+    int fd = openat(cache->dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = fd < 0 ? NULL : fdopendir(fd);
+    if (!dir) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    
+    struct cache_entry *entries = NULL;
+    size_t count = 0, capacity = 0;
+    off_t total = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir))) {
+        struct stat st;
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0 ||
+            strlen(ent->d_name) >= sizeof(entries->name) ||
+            fstatat(cache->dir_fd, ent->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0 ||
+            !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 32;
+            struct cache_entry *grown = realloc(entries, capacity * sizeof(*entries));
+            if (!grown) {
+                break;
+            }
+            entries = grown;
+        }
+        struct cache_entry *entry = &entries[count++];
+        snprintf(entry->name, sizeof(entry->name), "%s", ent->d_name);
+        entry->size = st.st_size;
+        entry->mtime = st.st_mtim;
+        total += st.st_size;
+    }
+    closedir(dir);
+    
+    if (total > (off_t)cache->max_size) {
+        qsort(entries, count, sizeof(*entries), compare_entries);
+        for (size_t i = 0; i < count && total > (off_t)cache->max_size; i++) {
+            if (unlinkat(cache->dir_fd, entries[i].name, 0) == 0) {
+                total -= entries[i].size;
+            }
+        }
+    }
+    free(entries);
+}
+
+bool render_cache_store(struct render_cache *cache, const struct buffer_key *key,
+                        uint32_t stride, const void *data) {
+    size_t size = (size_t)stride * key->height;
+    size_t tile_size;
+    const unsigned char *bits = tile_bits(key, &tile_size);
+    if (tile_size > TILE_MAX_SIZE || RENDER_CACHE_DATA_OFFSET + size > cache->max_size) {
+        return false;
+    }
+    
+    struct cache_header header;
+    build_header(&header, key, stride);
+    char name[32];
+    file_name(&header, name, sizeof(name));
+    
+    // Written under a temporary name and renamed, so a reader never sees
+    // a partial file
+    char tmp_name[64];
+    snprintf(tmp_name, sizeof(tmp_name), ".tmp-%ld-%s", (long)getpid(), name);
+    int fd = openat(cache->dir_fd, tmp_name,
+                    O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return false;
+    }
+    
+    bool ok = write_at(fd, &header, sizeof(header), 0) &&
+              write_at(fd, bits, tile_size, sizeof(header)) &&
+              write_at(fd, data, size, RENDER_CACHE_DATA_OFFSET);
+    close(fd);
+    if (!ok || renameat(cache->dir_fd, tmp_name, cache->dir_fd, name) < 0) {
+        unlinkat(cache->dir_fd, tmp_name, 0);
+        return false;
+    }
+    
+    evict(cache);
+    return true;
+}
@@ -0,0 +1,886 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "render.h"
+
+#include "bit-expand.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Size a replicated prefix grows to before it is copied as is
+#ifndef REPLICATE_CHUNK
+#define REPLICATE_CHUNK (64 * 1024)
+#endif
+
+// Rows rendered at a time while taking a mask
+#define MASK_CHUNK_ROWS 64
+
+// A run of device columns sampling the same pattern column
+struct coord_span {
+    unsigned int src;
+    uint32_t length;
+};
+
+// Box filter weights are fractions of FILTER_ONE
+#define FILTER_ONE 256
+// Pattern cells one device pixel can overlap at the smallest scale, 0.1
+#define FILTER_MAX_TAPS 12
+
+// The pattern cells one device coordinate covers and how much of each
+// Compared with memcmp, so unused weights must stay zero
+struct filter_taps {
+    unsigned int first;  // first pattern coordinate covered
+    unsigned int count;
+    uint16_t weights[FILTER_MAX_TAPS];  // sum to FILTER_ONE
+};
+
+struct render_plan {
+    struct render_params params;
+    unsigned int bpp;  // bytes per pixel
+    uint32_t fg;  // packed into the pixel format
+    uint32_t bg;
+    uint32_t width;
+    uint32_t height;
+    unsigned int *col_map;  // pattern column of each device column in one period
+    unsigned int *row_map;  // pattern row of each device row in one period
+    uint32_t period_x;
+    uint32_t period_y;
+    struct coord_span *spans;  // col_map run-length encoded, NULL to gather
+    uint32_t span_count;
+    
+    // Box filtering, used instead of the maps when set
+    struct filter_taps *col_taps;  // one period of device columns
+    uint32_t *col_runs;  // columns from each one on with identical taps
+    struct filter_taps *row_taps;  // one period of device rows
+    uint32_t palette[FILTER_ONE + 1];  // fg blended towards bg, packed
+};
+
+struct render_mask {
+    struct render_params params;  // what the coverage was taken from
+    uint32_t width;
+    uint32_t height;
+    uint32_t period_y;  // device rows before row_map repeats
+    unsigned int *row_map;  // mask row of each device row in one period
+    uint32_t rows;  // distinct rows, one per pattern row
+    size_t stride;  // bytes per mask row
+    unsigned char *bits;  // LSB first, as bit_expand() reads them
+};
+
+unsigned int pixel_format_bytes(enum pixel_format format) {
+    return format == PIXEL_FORMAT_RGB565 ? 2 : 4;
+}
+
+uint32_t pixel_format_pack(enum pixel_format format, uint32_t argb) {
+    switch (format) {
+    case PIXEL_FORMAT_RGB565:
+        return ((argb >> 8) & 0xF800) | ((argb >> 5) & 0x07E0) | ((argb >> 3) & 0x001F);
+    case PIXEL_FORMAT_XRGB8888:
+    case PIXEL_FORMAT_ARGB8888:
+        break;
+    }
+    return argb;
+}
+
+// Map a device coordinate to a pattern coordinate (nearest sampling)
+static unsigned int source_coord(uint32_t v, float scale, unsigned int size) {
+    return (unsigned int)fmodf(v / scale, (float)size);
+}
+
+// Compute the pattern coordinate of every device coordinate along one axis
+static unsigned int *build_coord_map(uint32_t count, float scale, unsigned int size) {
+    unsigned int *map = malloc(count * sizeof(*map));
+    if (!map) {
+        return NULL;
+    }
+    
+    for (uint32_t i = 0; i < count; i++) {
+        map[i] = source_coord(i, scale, size);
+    }
+    return map;
+}
+
+// Find the exact period of a sequence of count items of item_size bytes:
+// the smallest p with item i equal to item i - p for every i >= p
+// This is count minus the sequence's longest proper border (the KMP prefix
+// function), so it holds for any scale, including ones like 2.3 whose
+// period is several pattern widths long. Returns count if it never repeats
+static uint32_t sequence_period(const void *items, size_t item_size, uint32_t count) {
+    const uint8_t *item = items;
+    uint32_t *border = malloc(count * sizeof(*border));
+    if (!border) {
+        return count;  // still correct, only slower
+    }
+    
+    uint32_t k = 0;
+    border[0] = 0;
+    for (uint32_t i = 1; i < count; i++) {
+        while (k > 0 && memcmp(item + i * item_size, item + k * item_size, item_size) != 0) {
+            k = border[k - 1];
+        }
+        if (memcmp(item + i * item_size, item + k * item_size, item_size) == 0) {
+            k++;
+        }
+        border[i] = k;
+    }
+    
+    uint32_t period = count - border[count - 1];
+    free(border);
+    return period;
+}
+
+// Keep only the first period of a map or tap table
+static void *shrink_to_period(void *items, size_t item_size, uint32_t period) {
+    void *shrunk = realloc(items, period * item_size);
+    return shrunk ? shrunk : items;
+}
+
+// Compute the box filter footprint of every device coordinate along one axis
+// Device pixel v covers pattern coordinates [v / scale, (v + 1) / scale).
+// Weights are rounded from the running coverage so they always sum to
+// FILTER_ONE, and zero weights at either end are dropped
+static struct filter_taps *build_filter_taps(uint32_t count, float scale, unsigned int size) {
+    struct filter_taps *taps = calloc(count, sizeof(*taps));
+    if (!taps) {
+        return NULL;
+    }
+    
+    for (uint32_t v = 0; v < count; v++) {
+        struct filter_taps *t = &taps[v];
+        double begin = v / (double)scale;
+        double end = (v + 1) / (double)scale;
+        double cell = floor(begin);
+        
+        long covered = 0;
+        unsigned int n = 0;
+        for (; cell < end && n < FILTER_MAX_TAPS; cell += 1.0, n++) {
+            double hi = cell + 1.0 < end ? cell + 1.0 : end;
+            long total = n + 1 == FILTER_MAX_TAPS ? FILTER_ONE :
+                         lround((hi - begin) * scale * FILTER_ONE);
+            t->weights[n] = (uint16_t)(total - covered);
+            covered = total;
+        }
+        
+        unsigned int skip = 0;
+        while (skip < n && t->weights[skip] == 0) {
+            skip++;
+        }
+        while (n > skip && t->weights[n - 1] == 0) {
+            n--;
+        }
+        memmove(t->weights, t->weights + skip, (n - skip) * sizeof(t->weights[0]));
+        memset(t->weights + (n - skip), 0, (FILTER_MAX_TAPS - (n - skip)) * sizeof(t->weights[0]));
+        t->first = (unsigned int)fmod(floor(begin) + skip, size);
+        t->count = n - skip;
+    }
+    return taps;
+}
+
+// Whether every device coordinate lies within a single pattern cell
+static bool filter_taps_trivial(const struct filter_taps *taps, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (taps[i].count != 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Precompute fg blended towards bg in FILTER_ONE steps
+// Coverage is quantized, so blending a pixel is a single lookup
+static void build_palette(struct render_plan *plan) {
+    uint32_t fg = plan->params.fg;
+    uint32_t bg = plan->params.bg;
+    
+    for (unsigned int a = 0; a <= FILTER_ONE; a++) {
+        uint32_t argb = 0;
+        for (unsigned int shift = 0; shift < 32; shift += 8) {
+            int from = (fg >> shift) & 0xFF;
+            int to = (bg >> shift) & 0xFF;
+            int c = from + ((to - from) * (int)a + (to >= from ? FILTER_ONE / 2 : -FILTER_ONE / 2)) /
+                    FILTER_ONE;
+            argb |= (uint32_t)c << shift;
+        }
+        plan->palette[a] = pixel_format_pack(plan->params.format, argb);
+    }
+}
+
+// Set up box filtering for a plan
+// Returns false on allocation failure; leaves the plan unfiltered when the
+// scale maps every device pixel into one pattern cell, as integer ones do
+static bool plan_filter(struct render_plan *plan) {
+    const struct xbm_image *image = plan->params.image;
+    float scale = plan->params.scale;
+    
+    plan->col_taps = build_filter_taps(plan->width, scale, image->width);
+    plan->row_taps = build_filter_taps(plan->height, scale, image->height);
+    if (!plan->col_taps || !plan->row_taps) {
+        return false;
+    }
+    
+    if (filter_taps_trivial(plan->col_taps, plan->width) &&
+        filter_taps_trivial(plan->row_taps, plan->height)) {
+        free(plan->col_taps);
+        free(plan->row_taps);
+        plan->col_taps = NULL;
+        plan->row_taps = NULL;
+        return true;
+    }
+    
+    plan->period_x = sequence_period(plan->col_taps, sizeof(*plan->col_taps), plan->width);
+    plan->period_y = sequence_period(plan->row_taps, sizeof(*plan->row_taps), plan->height);
+    plan->col_taps = shrink_to_period(plan->col_taps, sizeof(*plan->col_taps), plan->period_x);
+    plan->row_taps = shrink_to_period(plan->row_taps, sizeof(*plan->row_taps), plan->period_y);
+    
+    // Columns inside one pattern cell repeat their neighbour's taps, and
+    // get the same color, so each run is summed once
+    plan->col_runs = malloc(plan->period_x * sizeof(*plan->col_runs));
+    if (!plan->col_runs) {
+        return false;
+    }
+    plan->col_runs[plan->period_x - 1] = 1;
+    for (uint32_t x = plan->period_x - 1; x-- > 0;) {
+        bool same = memcmp(&plan->col_taps[x], &plan->col_taps[x + 1],
+                           sizeof(*plan->col_taps)) == 0;
+        plan->col_runs[x] = same ? plan->col_runs[x + 1] + 1 : 1;
+    }
+    
+    build_palette(plan);
+    return true;
+}
+
+// Run-length encode one period of a column map
+// Returns NULL when runs are too short to beat gathering pixels one by one
+static struct coord_span *build_coord_spans(const unsigned int *map, uint32_t count,
+                                            uint32_t *span_count) {
+    uint32_t runs = 1;
+    for (uint32_t i = 1; i < count; i++) {
+        runs += map[i] != map[i - 1];
+    }
+    if (runs * 2 > count) {
+        return NULL;
+    }
+    
+    struct coord_span *spans = malloc(runs * sizeof(*spans));
+    if (!spans) {
+        return NULL;
+    }
+    
+    uint32_t n = 0;
+    spans[0] = (struct coord_span){ .src = map[0], .length = 1 };
+    for (uint32_t i = 1; i < count; i++) {
+        if (map[i] == spans[n].src) {
+            spans[n].length++;
+        } else {
+            spans[++n] = (struct coord_span){ .src = map[i], .length = 1 };
+        }
+    }
+    
+    *span_count = runs;
+    return spans;
+}
+
+// Expand count pattern bits into pixels, 1 = background, 0 = foreground
+// PBM rows are expanded MSB first in place, without reordering their bits
+static void expand_pixels(const struct render_plan *plan, void *dst,
+                          const unsigned char *src, size_t count) {
+    bool msb_first = plan->params.image->msb_first;
+    if (plan->bpp == 2) {
+        (msb_first ? bit_expand16_msb : bit_expand16)(dst, src, count,
+                                                      (uint16_t)plan->fg, (uint16_t)plan->bg);
+    } else {
+        (msb_first ? bit_expand_msb : bit_expand)(dst, src, count, plan->fg, plan->bg);
+    }
+}
+
+// Sample an expanded pattern row through the column map
+static void gather_pixels(const struct render_plan *plan, void *dst,
+                          const void *expanded, uint32_t count) {
+    if (plan->bpp == 2) {
+        uint16_t *out = dst;
+        const uint16_t *in = expanded;
+        for (uint32_t x = 0; x < count; x++) {
+            out[x] = in[plan->col_map[x]];
+        }
+    } else {
+        uint32_t *out = dst;
+        const uint32_t *in = expanded;
+        for (uint32_t x = 0; x < count; x++) {
+            out[x] = in[plan->col_map[x]];
+        }
+    }
+}
+
+// Fill device columns [0, count) by walking the column spans
+// Each span is one bit test and a run of stores of one color
+static void fill_spans(const struct render_plan *plan, void *dst,
+                       const unsigned char *src, uint32_t count) {
+    unsigned int flip = plan->params.image->msb_first ? 7 : 0;
+    uint32_t x = 0;
+    
+    for (uint32_t i = 0; i < plan->span_count && x < count; i++) {
+        const struct coord_span *span = &plan->spans[i];
+        unsigned int bit = (span->src & 7) ^ flip;
+        uint32_t color = (src[span->src >> 3] >> bit) & 1 ? plan->bg : plan->fg;
+        uint32_t end = span->length < count - x ? x + span->length : count;
+        
+        if (plan->bpp == 2) {
+            uint16_t *out = dst;
+            for (; x < end; x++) {
+                out[x] = (uint16_t)color;
+            }
+        } else {
+            uint32_t *out = dst;
+            for (; x < end; x++) {
+                out[x] = color;
+            }
+        }
+    }
+}
+
+// Fill dst[filled..total) by repeatedly copying the already-rendered prefix
+// The prefix doubles until it reaches REPLICATE_CHUNK bytes and is then
+// copied whole, so a few memcpys cover the buffer while their source stays
+// in cache instead of being read back from memory
+static void replicate(uint8_t *dst, size_t filled, size_t total) {
+    while (filled < total && filled < REPLICATE_CHUNK) {
+        size_t n = filled < total - filled ? filled : total - filled;
+        memcpy(dst + filled, dst, n);
+        filled += n;
+    }
+    
+    size_t chunk = filled;
+    while (filled < total) {
+        size_t n = chunk < total - filled ? chunk : total - filled;
+        memcpy(dst + filled, dst, n);
+        filled += n;
+    }
+}
+
+struct render_plan *render_plan_create(const struct render_params *params,
+                                       uint32_t width, uint32_t height) {
+    struct render_plan *plan = calloc(1, sizeof(*plan));
+    if (!plan) {
+        return NULL;
+    }
+    
+    plan->params = *params;
+    plan->bpp = pixel_format_bytes(params->format);
+    plan->fg = pixel_format_pack(params->format, params->fg);
+    plan->bg = pixel_format_pack(params->format, params->bg);
+    plan->width = width;
+    plan->height = height;
+    plan->period_x = width;
+    plan->period_y = height;
+    
+    const struct xbm_image *image = params->image;
+    if (!image || width == 0 || height == 0) {
+        return plan;
+    }
+    
+    if (params->filter == RENDER_FILTER_BOX && params->scale != 1.0f) {
+        if (!plan_filter(plan)) {
+            render_plan_destroy(plan);
+            return NULL;
+        }
+        if (plan->col_taps) {
+            return plan;
+        }
+    }
+    
+    plan->col_map = build_coord_map(width, params->scale, image->width);
+    plan->row_map = build_coord_map(height, params->scale, image->height);
+    if (!plan->col_map || !plan->row_map) {
+        render_plan_destroy(plan);
+        return NULL;
+    }
+    
+    // Only one period of each map is ever read
+    plan->period_x = sequence_period(plan->col_map, sizeof(*plan->col_map), width);
+    plan->period_y = sequence_period(plan->row_map, sizeof(*plan->row_map), height);
+    plan->col_map = shrink_to_period(plan->col_map, sizeof(*plan->col_map), plan->period_x);
+    plan->row_map = shrink_to_period(plan->row_map, sizeof(*plan->row_map), plan->period_y);
+    
+    if (params->scale != 1.0f) {
+        plan->spans = build_coord_spans(plan->col_map, plan->period_x, &plan->span_count);
+    }
+    return plan;
+}
+
+void render_plan_destroy(struct render_plan *plan) {
+    if (plan) {
+        free(plan->col_map);
+        free(plan->row_map);
+        free(plan->spans);
+        free(plan->col_taps);
+        free(plan->col_runs);
+        free(plan->row_taps);
+        free(plan);
+    }
+}
+
+// Store one solid pixel, then double it across count pixels
+static void fill_solid(const struct render_plan *plan, uint8_t *dst, uint32_t count) {
+    if (plan->bpp == 2) {
+        *(uint16_t *)dst = (uint16_t)plan->bg;
+    } else {
+        *(uint32_t *)dst = plan->bg;
+    }
+    replicate(dst, plan->bpp, (size_t)count * plan->bpp);
+}
+
+// Per-call scratch state for rendering pattern rows
+struct row_scratch {
+    uint32_t *row_origin;  // first row rendered for each pattern row
+    void *expanded;  // one pattern row expanded to pixels
+    uint16_t *coverage;  // box filtered coverage of each pattern column
+};
+
+static bool row_scratch_init(struct row_scratch *scratch, const struct render_plan *plan) {
+    const struct xbm_image *image = plan->params.image;
+    
+    scratch->row_origin = malloc(image->height * sizeof(*scratch->row_origin));
+    scratch->expanded = malloc((size_t)image->width * plan->bpp);
+    scratch->coverage = malloc(image->width * sizeof(*scratch->coverage));
+    if (!scratch->row_origin || !scratch->expanded || !scratch->coverage) {
+        free(scratch->row_origin);
+        free(scratch->expanded);
+        free(scratch->coverage);
+        return false;
+    }
+    
+    for (unsigned int i = 0; i < image->height; i++) {
+        scratch->row_origin[i] = UINT32_MAX;
+    }
+    return true;
+}
+
+static void row_scratch_finish(struct row_scratch *scratch) {
+    free(scratch->row_origin);
+    free(scratch->expanded);
+    free(scratch->coverage);
+}
+
+// Render pixels [0, count) of device row y with the box filter
+// A vertical pass sums the covered pattern rows into per-column coverage,
+// then each device column sums its pattern columns and looks up the blend
+static void filter_row(const struct render_plan *plan, struct row_scratch *scratch,
+                       uint8_t *row, uint32_t y, uint32_t count) {
+    const struct xbm_image *image = plan->params.image;
+    const struct filter_taps *vertical = &plan->row_taps[y % plan->period_y];
+    size_t bytes_per_row = (image->width + 7) / 8;
+    uint16_t *coverage = scratch->coverage;
+    uint16_t *weighted = scratch->expanded;  // at least 2 bytes per column
+    void (*expand)(uint16_t *, const unsigned char *, size_t, uint16_t, uint16_t) =
+        image->msb_first ? bit_expand16_msb : bit_expand16;
+    
+    // The SIMD bit expansion kernels turn each pattern row into 0 or its
+    // weight per column, which then add up in a vectorizable loop
+    for (unsigned int k = 0; k < vertical->count; k++) {
+        const unsigned char *src = image->bits +
+                                   (vertical->first + k) % image->height * bytes_per_row;
+        uint16_t weight = vertical->weights[k];
+        if (k == 0) {
+            expand(coverage, src, image->width, 0, weight);
+            continue;
+        }
+        expand(weighted, src, image->width, 0, weight);
+        for (unsigned int i = 0; i < image->width; i++) {
+            coverage[i] += weighted[i];
+        }
+    }
+    
+    uint32_t period_x = plan->period_x < count ? plan->period_x : count;
+    for (uint32_t x = 0; x < period_x;) {
+        const struct filter_taps *horizontal = &plan->col_taps[x];
+        unsigned int src_x = horizontal->first;
+        uint32_t sum = 0;
+        for (unsigned int k = 0; k < horizontal->count; k++) {
+            sum += (uint32_t)coverage[src_x] * horizontal->weights[k];
+            if (++src_x == image->width) {
+                src_x = 0;
+            }
+        }
+        
+        uint32_t pixel = plan->palette[(sum + FILTER_ONE / 2) / FILTER_ONE];
+        uint32_t end = plan->col_runs[x] < period_x - x ? x + plan->col_runs[x] : period_x;
+        if (plan->bpp == 2) {
+            for (uint16_t *out = (uint16_t *)row; x < end; x++) {
+                out[x] = (uint16_t)pixel;
+            }
+        } else {
+            for (uint32_t *out = (uint32_t *)row; x < end; x++) {
+                out[x] = pixel;
+            }
+        }
+    }
+    replicate(row, (size_t)period_x * plan->bpp, (size_t)count * plan->bpp);
+}
+
+// Render pixels [0, count) of a device row sampling pattern row src_y
+static void render_row(const struct render_plan *plan, struct row_scratch *scratch,
+                       uint8_t *row, unsigned int src_y, uint32_t count) {
+    const struct xbm_image *image = plan->params.image;
+    uint32_t period_x = plan->period_x < count ? plan->period_x : count;
+    
+    // XBM convention: 1 = background, 0 = foreground (matches xsetroot)
+    // PBM rows keep the same bit values, so xbmtopbm output renders alike
+    const unsigned char *src = image->bits + src_y * ((image->width + 7) / 8);
+    if (plan->params.scale == 1.0f) {
+        // Device columns map 1:1 onto pattern columns
+        expand_pixels(plan, row, src, period_x);
+    } else if (plan->spans) {
+        fill_spans(plan, row, src, period_x);
+    } else {
+        expand_pixels(plan, scratch->expanded, src, image->width);
+        gather_pixels(plan, row, scratch->expanded, period_x);
+    }
+    replicate(row, (size_t)period_x * plan->bpp, (size_t)count * plan->bpp);
+}
+
+// Memo slot of a filtered device row lying within a single pattern row
+// Such rows are identical wherever they occur. Returns NULL for rows that
+// blend several pattern rows
+static uint32_t *filter_row_origin(const struct render_plan *plan,
+                                   struct row_scratch *scratch, uint32_t y) {
+    const struct filter_taps *vertical = &plan->row_taps[y % plan->period_y];
+    return vertical->count == 1 ? &scratch->row_origin[vertical->first] : NULL;
+}
+
+bool render_plan_rows(const struct render_plan *plan, void *data,
+                      uint32_t stride, uint32_t y_begin, uint32_t y_end) {
+    uint8_t *rows = data;
+    uint32_t width = plan->width;
+    uint32_t count = y_end - y_begin;
+    size_t row_bytes = (size_t)width * plan->bpp;
+    
+    if (width == 0 || y_begin >= y_end) {
+        return true;
+    }
+    
+    if (!plan->params.image) {
+        // Solid background color
+        fill_solid(plan, rows, width);
+        replicate(rows, stride, (size_t)stride * count);
+        return true;
+    }
+    
+    struct row_scratch scratch;
+    if (!row_scratch_init(&scratch, plan)) {
+        return false;
+    }
+    
+    if (plan->row_taps) {
+        // Filtered rows are rendered for one period and replicated
+        uint32_t period_y = plan->period_y < count ? plan->period_y : count;
+        for (uint32_t y = 0; y < period_y; y++) {
+            uint8_t *row = rows + (size_t)y * stride;
+            uint32_t *origin = filter_row_origin(plan, &scratch, y_begin + y);
+            if (origin && *origin != UINT32_MAX) {
+                memcpy(row, rows + (size_t)*origin * stride, row_bytes);
+                continue;
+            }
+            if (origin) {
+                *origin = y;
+            }
+            filter_row(plan, &scratch, row, y_begin + y, width);
+        }
+        replicate(rows, (size_t)period_y * stride, (size_t)stride * count);
+        row_scratch_finish(&scratch);
+        return true;
+    }
+    
+    // A period too tall to stay in cache is not worth replicating as a
+    // block; rows are then copied one by one from their first occurrence
+    uint32_t period_y = plan->period_y < count ? plan->period_y : count;
+    if ((size_t)period_y * stride > REPLICATE_CHUNK) {
+        period_y = count;
+    }
+    
+    // Render one vertical period; rows that sample an already-rendered
+    // pattern row are copied instead of evaluated again
+    for (uint32_t y = 0; y < period_y; y++) {
+        uint8_t *row = rows + (size_t)y * stride;
+        unsigned int src_y = plan->row_map[(y_begin + y) % plan->period_y];
+        
+        if (scratch.row_origin[src_y] != UINT32_MAX) {
+            memcpy(row, rows + (size_t)scratch.row_origin[src_y] * stride, row_bytes);
+            continue;
+        }
+        scratch.row_origin[src_y] = y;
+        render_row(plan, &scratch, row, src_y, width);
+    }
+    
+    // The period is shift invariant, so the band's first period can be
+    // duplicated down the rest of the band
+    replicate(rows, (size_t)period_y * stride, (size_t)stride * count);
+    
+    row_scratch_finish(&scratch);
+    return true;
+}
+
+bool render_plan_rect(const struct render_plan *plan, void *data, uint32_t stride,
+                      uint32_t x_begin, uint32_t x_end,
+                      uint32_t y_begin, uint32_t y_end) {
+    if (x_begin == 0 && x_end == plan->width) {
+        return render_plan_rows(plan, data, stride, y_begin, y_end);
+    }
+    if (x_begin >= x_end || y_begin >= y_end) {
+        return true;
+    }
+    
+    uint8_t *rows = data;
+    unsigned int bpp = plan->bpp;
+    size_t offset = (size_t)x_begin * bpp;
+    size_t bytes = (size_t)(x_end - x_begin) * bpp;
+    
+    if (!plan->params.image) {
+        fill_solid(plan, rows + offset, x_end - x_begin);
+        for (uint32_t y = 1; y < y_end - y_begin; y++) {
+            memcpy(rows + (size_t)y * stride + offset, rows + offset, bytes);
+        }
+        return true;
+    }
+    
+    // Rows are rendered up to x_end in a scratch row and the requested
+    // columns copied out, so pixels left of x_begin are never touched
+    struct row_scratch scratch;
+    uint8_t *full_row = malloc((size_t)x_end * bpp);
+    if (!full_row || !row_scratch_init(&scratch, plan)) {
+        free(full_row);
+        return false;
+    }
+    
+    for (uint32_t y = 0; y < y_end - y_begin; y++) {
+        uint8_t *row = rows + (size_t)y * stride;
+        if (plan->row_taps) {
+            uint32_t *origin = filter_row_origin(plan, &scratch, y_begin + y);
+            if (origin && *origin != UINT32_MAX) {
+                memcpy(row + offset, rows + (size_t)*origin * stride + offset, bytes);
+                continue;
+            }
+            if (origin) {
+                *origin = y;
+            }
+            filter_row(plan, &scratch, full_row, y_begin + y, x_end);
+            memcpy(row + offset, full_row + offset, bytes);
+            continue;
+        }
+        
+        unsigned int src_y = plan->row_map[(y_begin + y) % plan->period_y];
+        
+        if (scratch.row_origin[src_y] != UINT32_MAX) {
+            memcpy(row + offset, rows + (size_t)scratch.row_origin[src_y] * stride + offset,
+                   bytes);
+            continue;
+        }
+        scratch.row_origin[src_y] = y;
+        render_row(plan, &scratch, full_row, src_y, x_end);
+        memcpy(row + offset, full_row + offset, bytes);
+    }
+    
+    row_scratch_finish(&scratch);
+    free(full_row);
+    return true;
+}
+
+struct render_mask *render_mask_create(const struct render_params *params,
+                                       uint32_t width, uint32_t height) {
+    if (width == 0 || height == 0) {
+        return NULL;
+    }
+    
+    // Rendered in two known colors, whose pixels then read back as bits
+    struct render_params mono = *params;
+    mono.fg = 0;
+    mono.bg = UINT32_MAX;
+    mono.format = PIXEL_FORMAT_XRGB8888;
+    struct render_plan *plan = render_plan_create(&mono, width, height);
+    if (!plan) {
+        return NULL;
+    }
+    
+    struct render_mask *mask = NULL;
+    uint32_t *pixels = NULL;
+    bool *taken = NULL;
+    if (plan->col_taps) {
+        goto out;  // filtered pixels blend fg and bg
+    }
+    
+    // Device rows sampling the same pattern row are identical, so one mask
+    // row is kept per pattern row and device rows find theirs via row_map
+    uint32_t period_y = params->image ? plan->period_y : 1;
+    uint32_t rows = params->image ? params->image->height : 1;
+    uint32_t chunk = period_y < MASK_CHUNK_ROWS ? period_y : MASK_CHUNK_ROWS;
+    size_t stride = (width + 7) / 8;
+    mask = calloc(1, sizeof(*mask));
+    pixels = malloc((size_t)width * chunk * sizeof(*pixels));
+    taken = calloc(rows, sizeof(*taken));
+    if (!mask || !pixels || !taken ||
+        !(mask->row_map = calloc(period_y, sizeof(*mask->row_map))) ||
+        !(mask->bits = calloc(rows, stride))) {
+        render_mask_destroy(mask);
+        mask = NULL;
+        goto out;
+    }
+    mask->params = *params;
+    mask->width = width;
+    mask->height = height;
+    mask->period_y = period_y;
+    mask->rows = rows;
+    mask->stride = stride;
+    if (params->image) {
+        memcpy(mask->row_map, plan->row_map, period_y * sizeof(*mask->row_map));
+    }
+    
+    for (uint32_t y = 0; y < period_y; y += chunk) {
+        uint32_t end = period_y - y > chunk ? y + chunk : period_y;
+        if (!render_plan_rows(plan, pixels, width * sizeof(*pixels), y, end)) {
+            render_mask_destroy(mask);
+            mask = NULL;
+            goto out;
+        }
+        for (uint32_t r = y; r < end; r++) {
+            unsigned int m = mask->row_map[r];
+            if (taken[m]) {
+                continue;
+            }
+            taken[m] = true;
+            const uint32_t *row = pixels + (size_t)(r - y) * width;
+            unsigned char *bits = mask->bits + (size_t)m * stride;
+            for (uint32_t x = 0; x < width; x++) {
+                bits[x / 8] |= (unsigned char)((row[x] & 1) << (x % 8));
+            }
+        }
+    }
+    
+out:
+    free(taken);
+    free(pixels);
+    render_plan_destroy(plan);
+    return mask;
+}
+
+void render_mask_destroy(struct render_mask *mask) {
+    if (mask) {
+        free(mask->row_map);
+        free(mask->bits);
+        free(mask);
+    }
+}
+
+bool render_mask_matches(const struct render_mask *mask, const struct render_params *params,
+                         uint32_t width, uint32_t height) {
+    return mask->width == width &&
+           mask->height == height &&
+           mask->params.image == params->image &&
+           mask->params.scale == params->scale &&
+           mask->params.filter == params->filter;
+}
+
+bool render_plan_recolor(const struct render_plan *plan, const struct render_mask *mask,
+                         void *data, uint32_t stride, uint32_t y_begin, uint32_t y_end) {
+    if (mask->width != plan->width || mask->height != plan->height) {
+        return false;
+    }
+    if (y_begin >= y_end) {
+        return true;
+    }
+    
+    uint8_t *rows = data;
+    uint32_t count = y_end - y_begin;
+    size_t row_bytes = (size_t)plan->width * plan->bpp;
+    uint32_t *row_origin = malloc(mask->rows * sizeof(*row_origin));
+    if (!row_origin) {
+        return false;
+    }
+    for (uint32_t i = 0; i < mask->rows; i++) {
+        row_origin[i] = UINT32_MAX;
+    }
+    
+    // Laid out as render_plan_rows() does: one period, each mask row
+    // expanded once and copied to its other rows, then replicated down the
+    // band. The expansion kernels are the two-entry palette lookup
+    uint32_t period_y = mask->period_y < count ? mask->period_y : count;
+    if ((size_t)period_y * stride > REPLICATE_CHUNK) {
+        period_y = count;
+    }
+    for (uint32_t y = 0; y < period_y; y++) {
+        uint8_t *row = rows + (size_t)y * stride;
+        unsigned int m = mask->row_map[(y_begin + y) % mask->period_y];
+        if (row_origin[m] != UINT32_MAX) {
+            memcpy(row, rows + (size_t)row_origin[m] * stride, row_bytes);
+            continue;
+        }
+        row_origin[m] = y;
+        
+        const unsigned char *bits = mask->bits + (size_t)m * mask->stride;
+        if (plan->bpp == 2) {
+            bit_expand16((uint16_t *)row, bits, plan->width,
+                         (uint16_t)plan->fg, (uint16_t)plan->bg);
+        } else {
+            bit_expand((uint32_t *)row, bits, plan->width, plan->fg, plan->bg);
+        }
+    }
+    replicate(rows, (size_t)period_y * stride, (size_t)stride * count);
+    
+    free(row_origin);
+    return true;
+}
+
+void render_band_run(void *data) {
+    struct render_band *band = data;
+    uint8_t *rows = (uint8_t *)band->data + (size_t)band->y_begin * band->stride;
+    if (band->mask) {
+        band->ok = render_plan_recolor(band->plan, band->mask, rows, band->stride,
+                                       band->y_begin, band->y_end);
+        return;
+    }
+    band->ok = render_plan_rect(band->plan, rows, band->stride,
+                                band->x_begin, band->x_end,
+                                band->y_begin, band->y_end);
+}
+
+// One side of a seamless tile, see render_tile_size()
+static uint32_t tile_side(uint32_t period, uint32_t align, uint32_t min_size, uint32_t size) {
+    uint64_t a = period, b = align;
+    while (b != 0) {
+        uint64_t r = a % b;
+        a = b;
+        b = r;
+    }
+    uint64_t unit = (uint64_t)period / a * align;
+    uint64_t side = (min_size + unit - 1) / unit * unit;
+    return side < size ? (uint32_t)side : size;
+}
+
+bool render_tile_size(const struct render_params *params, uint32_t width, uint32_t height,
+                      uint32_t min_size, uint32_t align,
+                      uint32_t *tile_width, uint32_t *tile_height) {
+    if (width == 0 || height == 0 || align == 0) {
+        return false;
+    }
+    
+    // The plan finds the periods over the whole buffer, so tiles repeat
+    // exactly even where float rounding makes the sampling drift
+    struct render_plan *plan = render_plan_create(params, width, height);
+    if (!plan) {
+        return false;
+    }
+    *tile_width = tile_side(plan->period_x, align, min_size, width);
+    *tile_height = tile_side(plan->period_y, align, min_size, height);
+    render_plan_destroy(plan);
+    return true;
+}
+
+bool render_pattern(const struct render_params *params, void *data,
+                    uint32_t width, uint32_t height, uint32_t stride) {
+    struct render_plan *plan = render_plan_create(params, width, height);
+    if (!plan) {
+        return false;
+    }
+    
+    bool ok = render_plan_rows(plan, data, stride, 0, height);
+    render_plan_destroy(plan);
+    return ok;
+}
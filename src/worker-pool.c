@@ -0,0 +1,151 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "worker-pool.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct worker_job {
+    struct worker_job *next;
+    void (*fn)(void *);
+    void *data;
+};
+
+struct worker_pool {
+    pthread_t *threads;
+    unsigned int thread_count;
+    
+    pthread_mutex_t lock;
+    pthread_cond_t job_ready;  // signalled when a job is queued
+    pthread_cond_t idle;  // signalled when pending drops to zero
+    
+    struct worker_job *head;
+    struct worker_job *tail;
+    unsigned int pending;  // queued plus running jobs
+    bool stopping;
+};
+
+static void *worker_main(void *data) {
+    struct worker_pool *pool = data;
+    
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->head && !pool->stopping) {
+            pthread_cond_wait(&pool->job_ready, &pool->lock);
+        }
+        if (!pool->head) {
+            break;
+        }
+        
+        struct worker_job *job = pool->head;
+        pool->head = job->next;
+        if (!pool->head) {
+            pool->tail = NULL;
+        }
+        
+        pthread_mutex_unlock(&pool->lock);
+        job->fn(job->data);
+        free(job);
+        pthread_mutex_lock(&pool->lock);
+        
+        if (--pool->pending == 0) {
+            pthread_cond_broadcast(&pool->idle);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    
+    return NULL;
+}
+
+struct worker_pool *worker_pool_create(unsigned int threads) {
+    struct worker_pool *pool = calloc(1, sizeof(*pool));
+    if (!pool) {
+        return NULL;
+    }
+    
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->job_ready, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+    
+    if (threads <= 1) {
+        return pool;
+    }
+    
+    pool->threads = calloc(threads, sizeof(*pool->threads));
+    if (!pool->threads) {
+        worker_pool_destroy(pool);
+        return NULL;
+    }
+    
+    for (unsigned int i = 0; i < threads; i++) {
+        int err = pthread_create(&pool->threads[i], NULL, worker_main, pool);
+        if (err != 0) {
+            // Carry on with the threads we have
+            fprintf(stderr, "Failed to create worker thread: %s\n", strerror(err));
+            break;
+        }
+        pool->thread_count++;
+    }
+    
+    return pool;
+}
+
+void worker_pool_destroy(struct worker_pool *pool) {
+    if (!pool) {
+        return;
+    }
+    
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->job_ready);
+    pthread_mutex_unlock(&pool->lock);
+    
+    for (unsigned int i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    
+    pthread_cond_destroy(&pool->idle);
+    pthread_cond_destroy(&pool->job_ready);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
+
+unsigned int worker_pool_size(const struct worker_pool *pool) {
+    return pool->thread_count > 0 ? pool->thread_count : 1;
+}
+
+void worker_pool_submit(struct worker_pool *pool, void (*fn)(void *), void *data) {
+    struct worker_job *job = NULL;
+    if (pool->thread_count > 0) {
+        job = calloc(1, sizeof(*job));
+    }
+    if (!job) {
+        fn(data);
+        return;
+    }
+    job->fn = fn;
+    job->data = data;
+    
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail) {
+        pool->tail->next = job;
+    } else {
+        pool->head = job;
+    }
+    pool->tail = job;
+    pool->pending++;
+    pthread_cond_signal(&pool->job_ready);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void worker_pool_wait(struct worker_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
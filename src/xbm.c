@@ -1,227 +1,515 @@
-#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
 
 #include "xbm.h"
 
-#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-// Skip whitespace and comments in the file
-static void skip_whitespace_and_comments(FILE *fp) {
-    int c;
-    while ((c = fgetc(fp)) != EOF) {
-        if (isspace(c)) {
-            continue;
-        }
-        if (c == '/') {
-            int next = fgetc(fp);
-            if (next == '*') {
-                // Block comment
-                while ((c = fgetc(fp)) != EOF) {
-                    if (c == '*') {
-                        if ((c = fgetc(fp)) == '/') {
-                            break;
-                        }
-                        ungetc(c, fp);
-                    }
+// Largest width or height accepted from a file
+#define XBM_MAX_DIMENSION 65536
+
+// Character classes for the tokenizer
+enum {
+    CHAR_OTHER,
+    CHAR_SPACE,
+    CHAR_DIGIT,
+    CHAR_IDENT,  // letters and underscore
+};
+
+static const unsigned char char_class[256] = {
+    [' '] = CHAR_SPACE, ['\t'] = CHAR_SPACE, ['\n'] = CHAR_SPACE,
+    ['\r'] = CHAR_SPACE, ['\v'] = CHAR_SPACE, ['\f'] = CHAR_SPACE,
+    ['0'] = CHAR_DIGIT, ['1'] = CHAR_DIGIT, ['2'] = CHAR_DIGIT, ['3'] = CHAR_DIGIT,
+    ['4'] = CHAR_DIGIT, ['5'] = CHAR_DIGIT, ['6'] = CHAR_DIGIT, ['7'] = CHAR_DIGIT,
+    ['8'] = CHAR_DIGIT, ['9'] = CHAR_DIGIT,
+    ['_'] = CHAR_IDENT,
+    ['a'] = CHAR_IDENT, ['b'] = CHAR_IDENT, ['c'] = CHAR_IDENT, ['d'] = CHAR_IDENT,
+    ['e'] = CHAR_IDENT, ['f'] = CHAR_IDENT, ['g'] = CHAR_IDENT, ['h'] = CHAR_IDENT,
+    ['i'] = CHAR_IDENT, ['j'] = CHAR_IDENT, ['k'] = CHAR_IDENT, ['l'] = CHAR_IDENT,
+    ['m'] = CHAR_IDENT, ['n'] = CHAR_IDENT, ['o'] = CHAR_IDENT, ['p'] = CHAR_IDENT,
+    ['q'] = CHAR_IDENT, ['r'] = CHAR_IDENT, ['s'] = CHAR_IDENT, ['t'] = CHAR_IDENT,
+    ['u'] = CHAR_IDENT, ['v'] = CHAR_IDENT, ['w'] = CHAR_IDENT, ['x'] = CHAR_IDENT,
+    ['y'] = CHAR_IDENT, ['z'] = CHAR_IDENT,
+    ['A'] = CHAR_IDENT, ['B'] = CHAR_IDENT, ['C'] = CHAR_IDENT, ['D'] = CHAR_IDENT,
+    ['E'] = CHAR_IDENT, ['F'] = CHAR_IDENT, ['G'] = CHAR_IDENT, ['H'] = CHAR_IDENT,
+    ['I'] = CHAR_IDENT, ['J'] = CHAR_IDENT, ['K'] = CHAR_IDENT, ['L'] = CHAR_IDENT,
+    ['M'] = CHAR_IDENT, ['N'] = CHAR_IDENT, ['O'] = CHAR_IDENT, ['P'] = CHAR_IDENT,
+    ['Q'] = CHAR_IDENT, ['R'] = CHAR_IDENT, ['S'] = CHAR_IDENT, ['T'] = CHAR_IDENT,
+    ['U'] = CHAR_IDENT, ['V'] = CHAR_IDENT, ['W'] = CHAR_IDENT, ['X'] = CHAR_IDENT,
+    ['Y'] = CHAR_IDENT, ['Z'] = CHAR_IDENT,
+};
+
+// Hex digit values plus one; 0 marks a character that is not a hex digit
+static const unsigned char hex_digit[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+struct xbm_parser {
+    const char *name;  // for error messages
+    const char *start;
+    const char *p;
+    const char *end;
+};
+
+// Report a syntax error at the current position with its line number
+static void parse_error(const struct xbm_parser *ps, const char *fmt, ...) {
+    unsigned int line = 1;
+    for (const char *c = ps->start; c < ps->p && c < ps->end; c++) {
+        line += *c == '\n';
+    }
+    
+    fprintf(stderr, "%s:%u: ", ps->name, line);
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+static int peek(const struct xbm_parser *ps) {
+    return ps->p < ps->end ? (unsigned char)*ps->p : EOF;
+}
+
+// Skip whitespace and C comments
+static bool skip_space(struct xbm_parser *ps) {
+    while (ps->p < ps->end) {
+        unsigned char c = (unsigned char)*ps->p;
+        if (char_class[c] == CHAR_SPACE) {
+            ps->p++;
+        } else if (c == '/' && ps->p + 1 < ps->end && ps->p[1] == '*') {
+            const char *close = NULL;
+            for (const char *q = ps->p + 2; q + 1 < ps->end; q++) {
+                if (q[0] == '*' && q[1] == '/') {
+                    close = q;
+                    break;
                 }
-            } else if (next == '/') {
-                // Line comment
-                while ((c = fgetc(fp)) != EOF && c != '\n');
-            } else {
-                ungetc(next, fp);
-                ungetc(c, fp);
-                return;
             }
+            if (!close) {
+                parse_error(ps, "unterminated comment");
+                return false;
+            }
+            ps->p = close + 2;
+        } else if (c == '/' && ps->p + 1 < ps->end && ps->p[1] == '/') {
+            const char *newline = memchr(ps->p, '\n', ps->end - ps->p);
+            ps->p = newline ? newline : ps->end;
         } else {
-            ungetc(c, fp);
-            return;
+            break;
         }
     }
+    return true;
 }
 
-// Read a #define directive and extract name and value
-static bool read_define(FILE *fp, char *name, size_t name_size, int *value) {
-    skip_whitespace_and_comments(fp);
-    
-    char line[256];
-    if (!fgets(line, sizeof(line), fp)) {
-        return false;
+// Read an identifier into a span; false if there is none
+static bool read_ident(struct xbm_parser *ps, const char **ident, size_t *len) {
+    const char *begin = ps->p;
+    while (ps->p < ps->end && char_class[(unsigned char)*ps->p] >= CHAR_DIGIT) {
+        ps->p++;
     }
+    *ident = begin;
+    *len = ps->p - begin;
+    return *len > 0 && char_class[(unsigned char)*begin] == CHAR_IDENT;
+}
+
+static bool ident_is(const char *ident, size_t len, const char *word) {
+    return strlen(word) == len && memcmp(ident, word, len) == 0;
+}
+
+static bool ident_ends_with(const char *ident, size_t len, const char *suffix) {
+    size_t suffix_len = strlen(suffix);
+    return len > suffix_len && memcmp(ident + len - suffix_len, suffix, suffix_len) == 0;
+}
+
+// Read an unsigned integer up to max: hex with a 0x prefix, octal with a
+// leading 0 and decimal otherwise, as C and strtoul(..., 0) read them
+static bool read_number(struct xbm_parser *ps, unsigned long max, unsigned long *value) {
+    const char *begin = ps->p;
+    unsigned long v = 0;
     
-    // Check for #define
-    char *p = line;
-    while (isspace(*p)) p++;
+    if (ps->end - ps->p > 2 && ps->p[0] == '0' && (ps->p[1] | 0x20) == 'x') {
+        ps->p += 2;
+        const char *digits = ps->p;
+        unsigned char d;
+        while (ps->p < ps->end && (d = hex_digit[(unsigned char)*ps->p]) != 0) {
+            v = v * 16 + (d - 1);
+            if (v > max) {
+                break;
+            }
+            ps->p++;
+        }
+        if (ps->p == digits) {
+            parse_error(ps, "expected hex digits after 0x");
+            return false;
+        }
+    } else {
+        unsigned int base = ps->p < ps->end && ps->p[0] == '0' ? 8 : 10;
+        while (ps->p < ps->end && char_class[(unsigned char)*ps->p] == CHAR_DIGIT &&
+               (unsigned int)(*ps->p - '0') < base) {
+            v = v * base + (unsigned long)(*ps->p - '0');
+            if (v > max) {
+                break;
+            }
+            ps->p++;
+        }
+        if (ps->p == begin) {
+            parse_error(ps, "expected a number");
+            return false;
+        }
+    }
     
-    if (strncmp(p, "#define", 7) != 0) {
+    if (v > max) {
+        ps->p = begin;
+        parse_error(ps, "value out of range (maximum %lu)", max);
         return false;
     }
-    p += 7;
-    
-    // Skip whitespace
-    while (isspace(*p)) p++;
-    
-    // Read name
-    char *name_start = p;
-    while (*p && !isspace(*p)) p++;
-    
-    size_t len = p - name_start;
-    if (len >= name_size) {
+    if (ps->p < ps->end && char_class[(unsigned char)*ps->p] >= CHAR_DIGIT) {
+        parse_error(ps, "invalid character '%c' in number", *ps->p);
         return false;
     }
-    strncpy(name, name_start, len);
-    name[len] = '\0';
-    
-    // Skip whitespace
-    while (isspace(*p)) p++;
+    *value = v;
+    return true;
+}
+
+// Expect a punctuation character after optional whitespace
+static bool expect(struct xbm_parser *ps, char c) {
+    if (!skip_space(ps)) {
+        return false;
+    }
+    if (peek(ps) != c) {
+        parse_error(ps, "expected '%c'", c);
+        return false;
+    }
+    ps->p++;
+    return true;
+}
+
+// Parse the #define lines ahead of the bits array
+static bool parse_defines(struct xbm_parser *ps, struct xbm_image *image) {
+    bool got_width = false, got_height = false;
     
-    // Read value
-    *value = (int)strtol(p, NULL, 0);
+    for (;;) {
+        if (!skip_space(ps)) {
+            return false;
+        }
+        if (peek(ps) != '#') {
+            break;
+        }
+        ps->p++;
+        
+        const char *ident;
+        size_t len;
+        skip_space(ps);
+        if (!read_ident(ps, &ident, &len) || !ident_is(ident, len, "define")) {
+            parse_error(ps, "expected #define");
+            return false;
+        }
+        skip_space(ps);
+        if (!read_ident(ps, &ident, &len)) {
+            parse_error(ps, "expected a macro name");
+            return false;
+        }
+        skip_space(ps);
+        
+        unsigned long value;
+        if (ident_ends_with(ident, len, "_width")) {
+            if (!read_number(ps, XBM_MAX_DIMENSION, &value)) {
+                return false;
+            }
+            image->width = (unsigned int)value;
+            got_width = true;
+        } else if (ident_ends_with(ident, len, "_height")) {
+            if (!read_number(ps, XBM_MAX_DIMENSION, &value)) {
+                return false;
+            }
+            image->height = (unsigned int)value;
+            got_height = true;
+        } else if (ident_ends_with(ident, len, "_x_hot")) {
+            if (!read_number(ps, XBM_MAX_DIMENSION, &value)) {
+                return false;
+            }
+            image->hotspot_x = (int)value;
+        } else if (ident_ends_with(ident, len, "_y_hot")) {
+            if (!read_number(ps, XBM_MAX_DIMENSION, &value)) {
+                return false;
+            }
+            image->hotspot_y = (int)value;
+        } else {
+            // Other macros are not ours to interpret
+            const char *newline = memchr(ps->p, '\n', ps->end - ps->p);
+            ps->p = newline ? newline : ps->end;
+        }
+    }
     
+    if (!got_width || !got_height) {
+        parse_error(ps, "missing %s definition", got_width ? "height" : "width");
+        return false;
+    }
+    if (image->width == 0 || image->height == 0) {
+        parse_error(ps, "invalid dimensions %ux%u", image->width, image->height);
+        return false;
+    }
     return true;
 }
 
-// Find the data array and parse it
-static unsigned char *parse_data_array(FILE *fp, size_t expected_size, size_t *actual_size) {
-    // Look for the opening brace
-    int c;
-    while ((c = fgetc(fp)) != EOF && c != '{');
+// Parse "static unsigned char name_bits[] = {" and return the element width
+// X10 bitmaps use 16-bit shorts, X11 ones bytes
+static unsigned int parse_declaration(struct xbm_parser *ps) {
+    unsigned int bits = 0;
+    const char *ident;
+    size_t len;
     
-    if (c == EOF) {
-        return NULL;
+    for (;;) {
+        skip_space(ps);
+        const char *at = ps->p;
+        if (!read_ident(ps, &ident, &len)) {
+            parse_error(ps, "expected the bits array declaration");
+            return 0;
+        }
+        if (ident_is(ident, len, "static") || ident_is(ident, len, "const") ||
+            ident_is(ident, len, "unsigned") || ident_is(ident, len, "signed")) {
+            continue;
+        }
+        if (ident_is(ident, len, "char")) {
+            bits = 8;
+        } else if (ident_is(ident, len, "short")) {
+            bits = 16;
+        } else if (bits != 0) {
+            break;  // the array name
+        } else {
+            ps->p = at;
+            parse_error(ps, "expected char or short");
+            return 0;
+        }
     }
     
-    // Allocate buffer
-    unsigned char *data = malloc(expected_size);
-    if (!data) {
-        return NULL;
+    // An explicit array size is allowed but not needed
+    if (!expect(ps, '[') || !skip_space(ps)) {
+        return 0;
     }
-    
+    unsigned long size;
+    if (peek(ps) != ']' && !read_number(ps, INT_MAX, &size)) {
+        return 0;
+    }
+    if (!expect(ps, ']') || !expect(ps, '=') || !expect(ps, '{')) {
+        return 0;
+    }
+    return bits;
+}
+
+// Decode the array values straight into the image's byte-padded rows
+static bool parse_bits(struct xbm_parser *ps, struct xbm_image *image,
+                       unsigned int value_bits) {
+    size_t row_bytes = (image->width + 7) / 8;
+    size_t row_values = (image->width + value_bits - 1) / value_bits;
+    size_t expected = row_values * image->height;
+    unsigned long max = value_bits == 16 ? 0xFFFF : 0xFF;
+    unsigned char *out = image->bits;
     size_t count = 0;
-    char hex_buf[16];
-    int hex_idx = 0;
-    
-    while ((c = fgetc(fp)) != EOF && c != '}') {
-        if (isspace(c) || c == ',') {
-            if (hex_idx > 0) {
-                hex_buf[hex_idx] = '\0';
-                
-                // Parse the hex value
-                char *endptr;
-                unsigned long val = strtoul(hex_buf, &endptr, 0);
-                
-                if (endptr != hex_buf && count < expected_size) {
-                    data[count++] = (unsigned char)val;
+    size_t column = 0;
+    
+    for (;;) {
+        // Runs of the usual "0xhh," decode in a tight loop; anything else,
+        // including the last value, goes through the checks below
+        if (value_bits == 8) {
+            const unsigned char *q = (const unsigned char *)ps->p;
+            const unsigned char *last = (const unsigned char *)ps->end - 5;
+            while (q < last) {
+                if (char_class[*q] == CHAR_SPACE) {
+                    q++;
+                    continue;
+                }
+                unsigned int high = hex_digit[q[2]], low = hex_digit[q[3]];
+                if (q[0] != '0' || (q[1] | 0x20) != 'x' || !high || !low ||
+                    q[4] != ',' || count == expected) {
+                    break;
                 }
-                hex_idx = 0;
+                *out++ = (unsigned char)((high - 1) * 16 + (low - 1));
+                count++;
+                q += 5;
+            }
+            ps->p = (const char *)q;
+        }
+        
+        if (!skip_space(ps)) {
+            return false;
+        }
+        if (peek(ps) == '}') {
+            break;
+        }
+        if (count == expected) {
+            parse_error(ps, "more than the %zu values %ux%u needs",
+                        expected, image->width, image->height);
+            return false;
+        }
+        
+        // The common form, 0x followed by two hex digits, decodes directly
+        unsigned long value;
+        const unsigned char *q = (const unsigned char *)ps->p;
+        if (value_bits == 8 && ps->end - ps->p > 4 && q[0] == '0' && (q[1] | 0x20) == 'x' &&
+            hex_digit[q[2]] && hex_digit[q[3]] && char_class[q[4]] < CHAR_DIGIT) {
+            value = (hex_digit[q[2]] - 1) * 16 + (hex_digit[q[3]] - 1);
+            ps->p += 4;
+        } else if (!read_number(ps, max, &value)) {
+            return false;
+        }
+        
+        if (value_bits == 8) {
+            *out++ = (unsigned char)value;
+        } else {
+            // Little-endian shorts; rows padded to 16 bits lose their last
+            // byte when a byte-padded row is one shorter
+            *out++ = (unsigned char)value;
+            if (column * 2 + 1 < row_bytes) {
+                *out++ = (unsigned char)(value >> 8);
+            }
+            if (++column == row_values) {
+                column = 0;
             }
-            continue;
         }
+        count++;
         
-        if (hex_idx < (int)(sizeof(hex_buf) - 1)) {
-            hex_buf[hex_idx++] = c;
+        if (!skip_space(ps)) {
+            return false;
+        }
+        if (peek(ps) == ',') {
+            ps->p++;
+        } else if (peek(ps) != '}') {
+            parse_error(ps, "expected ',' or '}'");
+            return false;
         }
     }
+    ps->p++;
     
-    // Handle last value if no trailing comma
-    if (hex_idx > 0 && count < expected_size) {
-        hex_buf[hex_idx] = '\0';
-        char *endptr;
-        unsigned long val = strtoul(hex_buf, &endptr, 0);
-        if (endptr != hex_buf) {
-            data[count++] = (unsigned char)val;
-        }
+    if (count != expected) {
+        parse_error(ps, "%zu values, but %ux%u needs %zu",
+                    count, image->width, image->height, expected);
+        return false;
     }
     
-    *actual_size = count;
-    return data;
+    // Only a semicolon may follow
+    if (!skip_space(ps)) {
+        return false;
+    }
+    if (peek(ps) == ';') {
+        ps->p++;
+    }
+    if (!skip_space(ps)) {
+        return false;
+    }
+    if (ps->p != ps->end) {
+        parse_error(ps, "unexpected text after the bits array");
+        return false;
+    }
+    return true;
 }
 
-struct xbm_image *xbm_load(const char *filename) {
-    FILE *fp = fopen(filename, "r");
-    if (!fp) {
-        fprintf(stderr, "Failed to open XBM file '%s': %s\n", filename, strerror(errno));
-        return NULL;
-    }
+struct xbm_image *xbm_parse(const char *data, size_t size, const char *name) {
+    struct xbm_parser ps = {
+        .name = name,
+        .start = data,
+        .p = data,
+        .end = data + size,
+    };
     
     struct xbm_image *image = calloc(1, sizeof(struct xbm_image));
     if (!image) {
-        fclose(fp);
         return NULL;
     }
-    
     image->hotspot_x = -1;
     image->hotspot_y = -1;
     
-    // Read all #defines
-    char name[256];
-    int value;
-    bool got_width = false, got_height = false;
-    
-    long pos = ftell(fp);
-    while (read_define(fp, name, sizeof(name), &value)) {
-        // Check for width
-        size_t len = strlen(name);
-        if (len >= 6 && strcmp(name + len - 6, "_width") == 0) {
-            image->width = value;
-            got_width = true;
-        } else if (len >= 7 && strcmp(name + len - 7, "_height") == 0) {
-            image->height = value;
-            got_height = true;
-        } else if (len >= 6 && strcmp(name + len - 6, "_x_hot") == 0) {
-            image->hotspot_x = value;
-        } else if (len >= 6 && strcmp(name + len - 6, "_y_hot") == 0) {
-            image->hotspot_y = value;
-        }
-        pos = ftell(fp);
+    unsigned int value_bits;
+    if (!parse_defines(&ps, image) || (value_bits = parse_declaration(&ps)) == 0) {
+        free(image);
+        return NULL;
     }
     
-    if (!got_width || !got_height) {
-        fprintf(stderr, "XBM file missing width or height definition\n");
+    image->bits = malloc((size_t)(image->width + 7) / 8 * image->height);
+    if (!image->bits) {
         free(image);
-        fclose(fp);
+        return NULL;
+    }
+    if (!parse_bits(&ps, image, value_bits)) {
+        xbm_free(image);
+        return NULL;
+    }
+    return image;
+}
+
+struct xbm_image *xbm_load(const char *filename) {
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open XBM file '%s': %s\n", filename, strerror(errno));
         return NULL;
     }
     
-    if (image->width == 0 || image->height == 0) {
-        fprintf(stderr, "Invalid XBM dimensions: %ux%u\n", image->width, image->height);
-        free(image);
-        fclose(fp);
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        fprintf(stderr, "XBM file '%s' is not a regular, non-empty file\n", filename);
+        close(fd);
         return NULL;
     }
     
-    // Calculate expected data size
-    // Each row is padded to byte boundary
-    size_t bytes_per_row = (image->width + 7) / 8;
-    size_t expected_size = bytes_per_row * image->height;
+    // Parsed in place from the page cache, without stdio buffering
+    size_t size = (size_t)st.st_size;
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Failed to map XBM file '%s': %s\n", filename, strerror(errno));
+        return NULL;
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
     
-    // Seek back to find the data array
-    fseek(fp, pos, SEEK_SET);
+    struct xbm_image *image = xbm_parse(data, size, filename);
+    munmap(data, size);
+    return image;
+}
+
+struct xbm_image *xbm_create(unsigned int width, unsigned int height,
+                             const unsigned char *bits) {
+    if (width == 0 || height == 0) {
+        return NULL;
+    }
     
-    size_t actual_size;
-    image->bits = parse_data_array(fp, expected_size, &actual_size);
+    struct xbm_image *image = calloc(1, sizeof(struct xbm_image));
+    if (!image) {
+        return NULL;
+    }
     
+    size_t size = (size_t)((width + 7) / 8) * height;
+    image->bits = calloc(1, size);
     if (!image->bits) {
-        fprintf(stderr, "Failed to parse XBM data array\n");
         free(image);
-        fclose(fp);
         return NULL;
     }
-    
-    if (actual_size < expected_size) {
-        fprintf(stderr, "Warning: XBM data array smaller than expected (%zu < %zu)\n",
-                actual_size, expected_size);
+    if (bits) {
+        memcpy(image->bits, bits, size);
     }
     
-    fclose(fp);
+    image->width = width;
+    image->height = height;
+    image->hotspot_x = -1;
+    image->hotspot_y = -1;
     return image;
 }
 
 void xbm_free(struct xbm_image *image) {
     if (image) {
-        free(image->bits);
+        if (image->mapping) {
+            munmap(image->mapping, image->mapping_size);
+        } else {
+            free(image->bits);
+        }
         free(image);
     }
 }
@@ -231,11 +519,10 @@ int xbm_get_pixel(const struct xbm_image *image, unsigned int x, unsigned int y)
         return 0;
     }
     
-    // XBM format: each row is padded to byte boundary
-    // Bits are stored LSB first within each byte
+    // Each row is padded to byte boundary
     size_t bytes_per_row = (image->width + 7) / 8;
     size_t byte_index = y * bytes_per_row + x / 8;
-    unsigned int bit_index = x % 8;
+    unsigned int bit_index = image->msb_first ? 7 - x % 8 : x % 8;
     
     return (image->bits[byte_index] >> bit_index) & 1;
 }
@@ -0,0 +1,108 @@
+// Build-time generator for the built-in pattern table
+// Usage: xbm2c <output.c> <file.xbm>...
+// Each bitmap is parsed with the runtime XBM parser and emitted as a
+// static const array in xbm_image layout, named after its file
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xbm.h"
+
+// Pattern name: file name without directories and the .xbm extension
+static bool pattern_name(const char *path, char *name, size_t size) {
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    size_t len = strlen(base);
+    if (len > 4 && strcmp(base + len - 4, ".xbm") == 0) {
+        len -= 4;
+    }
+    if (len == 0 || len >= size || (base[0] >= '0' && base[0] <= '9')) {
+        return false;
+    }
+    
+    for (size_t i = 0; i < len; i++) {
+        char c = base[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_')) {
+            return false;
+        }
+    }
+    memcpy(name, base, len);
+    name[len] = '\0';
+    return true;
+}
+
+static bool write_bits(FILE *out, const char *name, const struct xbm_image *image) {
+    size_t size = (size_t)(image->width + 7) / 8 * image->height;
+    
+    fprintf(out, "static const unsigned char %s_bits[] = {", name);
+    for (size_t i = 0; i < size; i++) {
+        fprintf(out, "%s0x%02x,", i % 12 == 0 ? "\n    " : " ", image->bits[i]);
+    }
+    fprintf(out, "\n};\n\n");
+    return !ferror(out);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <output.c> <file.xbm>...\n", argv[0]);
+        return 1;
+    }
+    
+    int count = argc - 2;
+    char (*names)[64] = calloc(count, sizeof(*names));
+    struct xbm_image **images = calloc(count, sizeof(*images));
+    FILE *out = fopen(argv[1], "w");
+    int ret = 1;
+    if (!names || !images || !out) {
+        fprintf(stderr, "Failed to create %s\n", argv[1]);
+        goto cleanup;
+    }
+    
+    fprintf(out, "// Generated by xbm2c from the bitmaps listed in meson.build\n"
+                 "// Do not edit\n\n"
+                 "#include \"builtin-patterns.h\"\n\n");
+    
+    for (int i = 0; i < count; i++) {
+        const char *path = argv[i + 2];
+        if (!pattern_name(path, names[i], sizeof(names[i]))) {
+            fprintf(stderr, "%s: name must be a lowercase C identifier\n", path);
+            goto cleanup;
+        }
+        for (int j = 0; j < i; j++) {
+            if (strcmp(names[i], names[j]) == 0) {
+                fprintf(stderr, "%s: duplicate pattern name %s\n", path, names[i]);
+                goto cleanup;
+            }
+        }
+        
+        images[i] = xbm_load(path);
+        if (!images[i] || !write_bits(out, names[i], images[i])) {
+            goto cleanup;
+        }
+    }
+    
+    fprintf(out, "const struct builtin_pattern builtin_patterns[] = {\n");
+    for (int i = 0; i < count; i++) {
+        fprintf(out, "    { \"%s\", %u, %u, %s_bits },\n",
+                names[i], images[i]->width, images[i]->height, names[i]);
+    }
+    fprintf(out, "};\n\nconst unsigned int builtin_pattern_count = %d;\n", count);
+    ret = 0;
+    
+cleanup:
+    if (out && fclose(out) != 0) {
+        ret = 1;
+    }
+    if (ret != 0) {
+        remove(argv[1]);
+    }
+    for (int i = 0; images && i < count; i++) {
+        xbm_free(images[i]);
+    }
+    free(images);
+    free(names);
+    return ret;
+}